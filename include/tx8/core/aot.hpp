@@ -0,0 +1,110 @@
+/**
+ * @file aot.hpp
+ * @brief Ahead-of-time translation of tx8 roms to C++.
+ * @details `tx::aot::Translator` recovers the control flow of a rom starting at the entry point and emits a C++
+ * translation unit containing the rom and a function `tx8_aot_run(tx::CPU&)`, which executes the recovered code as
+ * straight C++ and behaves like `tx::CPU::run`. The unit also defines `main` (running the rom with the stdlib like
+ * `tx8-cli run`), unless `TX8_AOT_NO_MAIN` is defined. Translated code uses `tx::aot::Runtime` for everything that
+ * needs the cpu: instructions without a native translation call their handler, jumps to code that was not recovered
+ * are interpreted, and writes to recovered code make the rest of the run fall back to the interpreter.
+ */
+#pragma once
+
+#include "tx8/core/cpu.hpp"
+#include "tx8/core/instruction.hpp"
+#include "tx8/core/types.hpp"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace tx::aot {
+    /// @brief Recovers the code of a rom and translates it to C++
+    class Translator {
+      public:
+        /// Prepare the translation of the given rom
+        explicit Translator(const Rom& rom);
+
+        /// Get the addresses of all instructions reachable from the entry point, in ascending order
+        std::vector<mem_addr> recover();
+        /// Translate the rom to a C++ translation unit; `source` is the rom name mentioned in its header comment
+        std::string translate(const std::string& source);
+
+      private:
+        Rom rom;
+        /// Cpu holding the rom, used to parse instructions
+        CPU cpu;
+
+        /// Check if the given address lies inside the rom
+        bool in_rom(mem_addr addr) const;
+        /// Translate the instruction with the given index in `code` to C++ statements
+        std::string translate_instruction(size_t index, const std::vector<mem_addr>& code);
+    };
+
+    /// @brief Support functions for translated code
+    class Runtime {
+      public:
+        /// Attach to a cpu that is about to execute the translated rom, given the rom contents and the addresses of the
+        /// instructions that were translated
+        Runtime(CPU& cpu, const uint8* rom, size_t rom_size, const mem_addr* code, size_t code_size);
+
+        /// Check if translated code may continue, like the checks at the start of every run loop iteration; if the cpu
+        /// does not execute the translated rom (anymore), the interpreter finishes the run instead
+        bool running();
+        /// Execute the instruction at the program counter with the interpreter
+        void step();
+        /// Execute the translated instruction with the given index through its handler; returns true if translated code
+        /// has to leave the instruction sequence (p changed, the cpu halted, recovered code was overwritten or an
+        /// interrupt may become due), with p set to where execution continues
+        bool exec(size_t index);
+
+        /// Read a memory word
+        inline uint32 read(mem_addr location) { return cpu.mem_read<ValueSize::Word>(location); }
+
+        /// Add `value` to `dst`, then set r to the unsigned (bit 0) and signed (bit 1) overflow flags
+        static inline void add(uint32& dst, uint32 value, uint32& r) {
+            uint32 result;
+            int32  signed_result;
+            uint32 flags = __builtin_add_overflow(dst, value, &result);
+            flags |= (uint32) __builtin_add_overflow((int32) dst, (int32) value, &signed_result) << 1;
+            dst = result;
+            r   = flags;
+        }
+
+        /// Subtract `value` from `dst`, then set r to the unsigned (bit 0) and signed (bit 1) overflow flags
+        static inline void sub(uint32& dst, uint32 value, uint32& r) {
+            uint32 result;
+            int32  signed_result;
+            uint32 flags = __builtin_sub_overflow(dst, value, &result);
+            flags |= (uint32) __builtin_sub_overflow((int32) dst, (int32) value, &signed_result) << 1;
+            dst = result;
+            r   = flags;
+        }
+
+        /// Compare two values as signed integers (-1, 0 or 1)
+        static inline uint32 cmp(uint32 a, uint32 b) { return ((int32) a > (int32) b) - ((int32) a < (int32) b); }
+        /// Compare two values as unsigned integers (-1, 0 or 1)
+        static inline uint32 ucmp(uint32 a, uint32 b) { return (a > b) - (a < b); }
+
+      private:
+        /// A translated instruction executed through its handler
+        struct Call {
+            mem_addr    addr;
+            Instruction inst;
+            OpHandler   handler;
+        };
+
+        CPU& cpu;
+        /// Translated instructions by index
+        std::vector<Call> code;
+        /// If the cpu memory held the translated rom when attaching
+        bool matches;
+        /// Code version of the cpu after attaching, see `CPU::code_version`
+        uint64 code_version = 0;
+    };
+} // namespace tx::aot
+
+/// Get the rom a translation unit generated by `tx::aot::Translator` was translated from
+tx::Rom tx8_aot_rom();
+/// Run a cpu holding the rom returned by `tx8_aot_rom` with the translated code, like `tx::CPU::run`
+void tx8_aot_run(tx::CPU& cpu);
@@ -0,0 +1,58 @@
+/**
+ * @file batch.hpp
+ * @brief Running many roms in parallel.
+ * @details `tx::batch::run` executes a list of jobs (a rom file, optionally with the bytes its `get` calls read) on a
+ * work-stealing pool of threads, one cpu per job, and reports the exit state, executed instructions, wall time and
+ * captured output of each job. Jobs are distributed round robin; threads that run out of jobs steal from the other
+ * end of another thread's queue, so long running roms do not leave the other threads idle. The output of every job is
+ * captured through the sinks of its cpu (see `tx::CpuSinks`); debug output of the jobs is discarded, so the global
+ * loggers are never used by the worker threads.
+ */
+#pragma once
+
+#include "tx8/core/memory.hpp"
+#include "tx8/core/types.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace tx::batch {
+    /// A rom to run
+    struct Job {
+        /// Path of the rom file (only used for reporting if `rom` is set)
+        std::string path;
+        /// Bytes returned by the `get` sysfunc (`EOF` afterwards)
+        std::string input;
+        /// Already loaded rom to run instead of the rom file (e. g. an assembled source file)
+        std::shared_ptr<const SharedRom> rom;
+    };
+
+    /// The outcome of a job
+    struct Result {
+        /// Index of the job in the job list
+        size_t job;
+        /// If the rom halted with an error (or the rom file could not be loaded)
+        bool error;
+        /// Registers when the rom halted
+        uint32 a, p;
+        /// Number of executed instructions
+        uint64 instructions;
+        /// Wall time of the job in seconds (including loading the rom)
+        double seconds;
+        /// Captured output of the rom
+        std::string output;
+        /// Captured error messages
+        std::string errors;
+    };
+
+    /// Called with every result, never concurrently (results arrive in the order the jobs finish)
+    using ResultHandler = std::function<void(const Result& result)>;
+
+    /// Run all jobs on `threads` threads (0 for one per hardware thread) and report their results
+    void run(const std::vector<Job>& jobs, const ResultHandler& on_result, size_t threads = 0);
+
+    /// Format a result of the given job as one line of JSON (without the trailing newline)
+    std::string to_json(const Job& job, const Result& result);
+} // namespace tx::batch
@@ -8,16 +8,25 @@
 
 #include "tx8/core/instruction.hpp"
 #include "tx8/core/log.hpp"
+#include "tx8/core/memory.hpp"
 #include "tx8/core/types.hpp"
+#include "tx8/core/util.hpp"
 
+#include <deque>
 #include <fmt/format.h>
 #include <functional>
 #include <map>
+#include <memory>
+#include <span>
 #include <string>
+#include <type_traits>
 
 namespace tx {
     /// The size of the tx8 memory in bytes
     const uint32 MEM_SIZE = 0xffffffU;
+    /// The number of zeroed bytes allocated past the end of the tx8 memory, so fixed size accesses at the edge of the
+    /// memory stay inside of the allocation (at least the size of the widest access, a vector operand)
+    const uint32 MEM_GUARD_SIZE = 16;
     /// The default position of the stack in tx8 memory
     const uint32 STACK_BEGIN = 0xc02000U;
     /// The default starting point for code in tx8 memory
@@ -32,16 +41,228 @@ namespace tx {
     const uint32 RANDOM_MAX = 0x7fff;
     /// The initial random seed
     const uint32 RAND_INITIAL_SEED = 0x12345678;
+    /// The number of address bits covered by one page of the decoded instruction cache
+    const uint32 DECODE_PAGE_BITS = 12;
+    /// The number of instructions (addresses) in one page of the decoded instruction cache
+    const uint32 DECODE_PAGE_SIZE = 1U << DECODE_PAGE_BITS;
+    /// The number of pages needed to cover the whole tx8 memory with the decoded instruction cache
+    const uint32 DECODE_PAGE_COUNT = (MEM_SIZE >> DECODE_PAGE_BITS) + 1;
+    /// The maximum number of instructions in a fusion
+    const uint32 FUSION_MAX_LENGTH = 3;
+    /// The maximum number of bytes covered by one slot of the decoded instruction cache (a fused instruction sequence)
+    const uint32 DECODE_MAX_SPAN = FUSION_MAX_LENGTH * INSTRUCTION_MAX_LENGTH;
+    /// The number of entries after which the JIT compiles a block by default
+    const uint32 JIT_DEFAULT_THRESHOLD = 32;
+    /// The number of address bits covered by one memory page saved for snapshots
+    const uint32 SNAPSHOT_PAGE_BITS = 12;
+    /// The number of bytes in one memory page saved for snapshots
+    const uint32 SNAPSHOT_PAGE_SIZE = 1U << SNAPSHOT_PAGE_BITS;
+    /// The number of pages needed to cover the whole tx8 memory with snapshot pages
+    const uint32 SNAPSHOT_PAGE_COUNT = (MEM_SIZE >> SNAPSHOT_PAGE_BITS) + 1;
+    /// The number of address bits covered by one page of the memory bus (the granularity of device mappings)
+    const uint32 BUS_PAGE_BITS = 12;
+    /// The number of bytes in one page of the memory bus
+    const uint32 BUS_PAGE_SIZE = 1U << BUS_PAGE_BITS;
+    /// The number of pages needed to cover the whole tx8 memory with the memory bus
+    const uint32 BUS_PAGE_COUNT = (MEM_SIZE >> BUS_PAGE_BITS) + 1;
+    /// The number of interrupts of a tx8 cpu
+    const uint32 INTERRUPT_COUNT = 16;
+    /// The position of the interrupt vector table in tx8 memory (the address of the handler of every interrupt, 0 if
+    /// it has none)
+    const uint32 IVT_START = 0x000000U;
+    /// The interrupt raised by the timer (see the `set_timer` sysfunc)
+    const uint32 INTERRUPT_TIMER = 0;
+    /// The interrupt reserved for the start of every vertical blank of the display (nothing raises it yet, as the
+    /// display is not emulated)
+    const uint32 INTERRUPT_VBLANK = 1;
+    /// The maximum number of bytes of a loop the cpu skips if it only waits for an interrupt
+    const uint32 IDLE_LOOP_MAX_LENGTH = 64;
+    /// The number of loops whose side effects the cpu remembers for detecting idle loops
+    const uint32 IDLE_LOOP_CACHE_SIZE = 16;
 
     class CPU;
+    class Jit;
+    namespace aot {
+        class Translator;
+        class Runtime;
+    } // namespace aot
+    /// The lanes of an operand of the vector instructions
+    using Vec4 = std::array<float32, 4>;
+    /// The host integer type holding a tx8 value of the given size
+    template <ValueSize size>
+    using mem_value_t = std::conditional_t<
+        size == ValueSize::Byte,
+        uint8,
+        std::conditional_t<size == ValueSize::Short, uint16, uint32>>;
     /// A tx8 cpu system function
     using Sysfunc = std::function<void(CPU& cpu)>;
+    /// A tx8 cpu opcode handler function
+    using OpHandler = void (CPU::*)(const Parameters& params);
+
+    /// A parsed instruction together with the handlers the decoder selected for it
+    struct DecodedInstruction {
+        Instruction inst;
+        /// Handler executing only this instruction
+        OpHandler handler;
+        /// Handler dispatched by the run loop; either `handler` or a fused handler also executing the next instructions
+        /// (null if the decoder did not look for fusions yet)
+        OpHandler entry;
+        /// Slot of the instruction following this one (only set for instructions that are part of a fusion)
+        const DecodedInstruction* next;
+        /// Number of bytes the run loop advances the program counter by if `entry` did not change it
+        uint8 advance;
+        /// Number of bytes of the instructions `entry` executes (more than `inst.len` for fusions), so the run loop can
+        /// tell execution that continued sequentially from a jump
+        uint8 length;
+    };
+
+    /// A sequence of opcodes that the decoder executes with a single dispatch when they appear one after another
+    struct Fusion {
+        std::array<Opcode, FUSION_MAX_LENGTH> ops;
+        uint8                                 length;
+    };
+
+    /// Counts of opcode pairs executed one after another, used to derive new fusions
+    struct FusionProfile {
+        /// Pair counts indexed by `first << 8 | second`
+        std::array<uint64, 0x10000> counts {};
+        /// Address right after the previously executed instruction
+        mem_addr next = 0;
+        /// Opcode of the previously executed instruction
+        Opcode last = Opcode::Invalid;
+    };
+
+    /// An addition or subtraction whose overflow flags become the value of the R register once it is read
+    struct LazyR {
+        /// Opcode::Add or Opcode::Sub, or Opcode::Invalid if the R register holds its actual value
+        Opcode op = Opcode::Invalid;
+        /// Size of the operation
+        ValueSize size = ValueSize::Word;
+        /// Operands of the operation
+        uint32 a = 0, b = 0;
+    };
+
+    /// An interrupt the cpu raises once its cycle count reaches `cycle` (see `CPU::schedule_interrupt`)
+    struct ScheduledInterrupt {
+        uint64 cycle;
+        /// Number of cycles after which the interrupt is raised again (0 if it is only raised once)
+        uint64 period;
+        /// Orders interrupts scheduled for the same cycle by the time they were scheduled
+        uint64 order;
+        uint32 interrupt;
+
+        /// Order for the min-heap of scheduled interrupts
+        inline bool operator>(const ScheduledInterrupt& other) const {
+            return cycle != other.cycle ? cycle > other.cycle : order > other.order;
+        }
+    };
+
+    /// Cpu state captured by `CPU::snapshot` (the memory is saved by the cpu page by page on the first write
+    /// afterwards)
+    struct Snapshot {
+        std::array<uint32, REGISTER_COUNT> registers;
+        uint32                             rseed;
+        bool                               halted;
+        bool                               stopped;
+        bool                               interrupts_enabled;
+        uint32                             pending_interrupts;
+        std::vector<ScheduledInterrupt>    scheduled;
+        /// Cycle count of the cpu when the snapshot was taken (scheduled interrupts are restored relative to it)
+        uint64 cycles;
+        /// Identifies the snapshot, as only the latest snapshot of a cpu can be restored
+        uint64 id;
+    };
+
+    /// Memory pages saved since the latest snapshot
+    struct SnapshotPages {
+        /// Marks pages without saved contents in `slots`
+        static constexpr uint32 NO_SLOT = 0xffffffff;
+
+        /// Id of the snapshot the pages belong to
+        uint64 id = 0;
+        /// Index of the saved contents of each page (NO_SLOT if the page was not written since the snapshot)
+        std::vector<uint32> slots = std::vector<uint32>(SNAPSHOT_PAGE_COUNT, NO_SLOT);
+        /// Saved pages in the order of their slots
+        std::vector<uint32> saved;
+        /// Saved page contents, one SNAPSHOT_PAGE_SIZE block per slot
+        std::vector<uint8> contents;
+        /// Whether each page was written since the snapshot or the last restore
+        std::vector<bool> is_dirty = std::vector<bool>(SNAPSHOT_PAGE_COUNT, false);
+        /// Pages written since the snapshot or the last restore
+        std::vector<uint32> dirty;
+    };
+
+    /// Split the `count` bytes starting at `location` into the parts that lie inside of the memory and call
+    /// `func(address, offset, length)` for each part, where `offset` is the position of the part within the range
+    /// Addresses wrap around at 24 bits and the byte at MEM_SIZE is out of bounds, like for byte by byte accesses
+    template <typename Func>
+    inline void mem_spans(mem_addr location, uint32 count, Func func) {
+        location &= MEM_SIZE;
+        uint32 offset = 0;
+        while (offset < count) {
+            if (location == MEM_SIZE) {
+                ++offset;
+                location = 0;
+                continue;
+            }
+            uint32 length = MIN(count - offset, MEM_SIZE - location);
+            func(location, offset, length);
+            offset += length;
+            location += length;
+        }
+    }
+
+    /// @brief A device mapped into tx8 memory (see `CPU::map_device`)
+    /// @details Accesses lying inside of the mapped range are passed on whole, accesses crossing its boundary byte by
+    /// byte. Instructions are fetched through `read` as well, and their decoded form is cached like for memory.
+    class Device {
+      public:
+        virtual ~Device() = default;
+        /// Read a value of the given size at `offset` bytes into the mapped range
+        virtual uint32 read(mem_addr offset, ValueSize size) = 0;
+        /// Write a value of the given size at `offset` bytes into the mapped range
+        virtual void write(mem_addr offset, uint32 value, ValueSize size) = 0;
+    };
+
+    /// Loggers a cpu writes the output of the rom, its errors and its debug output to (the global loggers by default;
+    /// cpus running on different threads need their own loggers, as loggers are not thread safe)
+    struct CpuSinks {
+        Log* out   = &tx::log;
+        Log* err   = &tx::log_err;
+        Log* debug = &tx::log_debug;
+    };
+
+    /// Counters describing the work done by a cpu
+    struct CpuStats {
+        /// Number of handler dispatches by the run loop
+        uint64 dispatches = 0;
+        /// Number of instructions executed as part of a fusion, not counting the first one
+        uint64 fused = 0;
+        /// Number of instructions executed by compiled blocks
+        uint64 compiled = 0;
+        /// Number of cycles skipped while stopped or spinning in an idle loop, waiting for an interrupt
+        uint64 idle = 0;
+        /// Number of times an idle loop (a loop polling unchanged memory) was skipped up to the next interrupt
+        uint64 idle_loops = 0;
+        /// Number of interrupts whose handler was called
+        uint64 interrupts = 0;
+        /// Number of writes to pages holding decoded code, which had to look for overwritten instructions
+        uint64 code_writes = 0;
+        /// Number of times decoded instructions were discarded because their memory was modified
+        uint64 invalidations = 0;
+
+        /// Total number of executed instructions
+        inline uint64 instructions() const { return dispatches + fused + compiled; }
+        /// Number of cycles passed (one per instruction), the time base of scheduled interrupts
+        inline uint64 cycles() const { return instructions() + idle; }
+    };
 
     /// @brief Struct representing a tx8 CPU with memory, registers, system function table and a random seed.
     class CPU {
       public:
-        /// Pointer to the cpu memory
-        std::vector<uint8> mem;
+        /// The cpu memory, allocated lazily page by page (see `Memory`)
+        /// Writes that bypass `mem_write` must be followed by a call to `invalidate_decode_cache`
+        Memory mem;
         /// Union for easy access to the cpu registers though simple identifiers and array indexing
         union {
             struct {
@@ -51,31 +272,209 @@ namespace tx {
         };
 
       private:
-        /// System function table
-        std::map<uint32, Sysfunc> sys_func_table;
+        friend class Jit;
+        friend class aot::Translator;
+        friend class aot::Runtime;
+
+        /// One page of the decoded instruction cache, indexed by the lower address bits (len 0 marks an empty slot)
+        using DecodePage = std::array<DecodedInstruction, DECODE_PAGE_SIZE>;
+
+        /// System functions in the order of their registration (a deque, so functions stay in place while running)
+        std::deque<Sysfunc> sysfuncs;
+        /// Index into `sysfuncs` of every system function by the hash of its name
+        std::map<uint32, uint32> sysfunc_indices;
+        /// Lazily allocated pages of already parsed instructions, indexed by memory address (never freed, so slot
+        /// pointers stay valid)
+        std::vector<std::unique_ptr<DecodePage>> decode_cache;
+        /// One bit for every page of the decoded instruction cache, set if decoded or compiled instructions overlap the
+        /// page since the last `invalidate_decode_cache`
+        std::array<uint64, DECODE_PAGE_COUNT / 64> code_pages = {};
+        /// Slot of the instruction the run loop is currently executing
+        const DecodedInstruction* current = nullptr;
+        /// Opcode sequences the decoder fuses
+        std::vector<Fusion> fusions;
+        /// Opcode pair counts (null if not profiling)
+        std::unique_ptr<FusionProfile> fusion_profile;
+        /// Incremented whenever cached decoded instructions are discarded, so translated code can notice modifications
+        uint64 code_version = 0;
+        /// Operation the R register value is pending for (see `materialize_r`)
+        LazyR lazy_r;
+        /// Memory pages saved for the latest snapshot (null if no snapshot was taken)
+        std::unique_ptr<SnapshotPages> snapshot_pages;
+        /// A device mapped to `count` bytes starting at `first`
+        struct DeviceMapping {
+            Device*  device;
+            mem_addr first;
+            uint32   count;
+        };
+        /// Host memory of every bus page, offset so that adding an address points at its byte; null for device pages
+        /// and the pages right before them, accesses to which take the slow path (`bus_read` / `bus_write`)
+        std::vector<uint8*> page_table;
+        /// Mapped devices
+        std::vector<DeviceMapping> devices;
+        /// JIT compiling hot blocks (null if disabled)
+        std::unique_ptr<Jit> jit;
         /// Random seed
         uint32 rseed;
         /// If the cpu is currently halted (finished execution)
         bool halted;
         /// If the cpu is currently idle and waiting for an interrupt
         bool stopped;
+        /// If raised interrupts call their handlers (`ei` / `di`)
+        bool interrupts_enabled = false;
+        /// One bit for every raised interrupt whose handler was not called yet
+        uint32 pending_interrupts = 0;
+        /// Min-heap of scheduled interrupts, the next one first
+        std::vector<ScheduledInterrupt> scheduled;
+        /// Number of interrupts scheduled so far, see `ScheduledInterrupt::order`
+        uint64 schedule_count = 0;
+        /// Marks that no interrupt has to be handled in `next_event`
+        static constexpr uint64 NO_EVENT = ~0ULL;
+        /// Result of checking a loop for side effects
+        struct IdleLoop {
+            /// Jump target starting the loop
+            mem_addr start = 0;
+            /// Address right after the jump back to `start`
+            mem_addr end = 0;
+            /// Value of `code_version` when the loop was checked
+            uint64 code_version = ~0ULL;
+            /// If the loop only modifies registers, so it waits for an interrupt once an iteration leaves them as they
+            /// were
+            bool pure = false;
+        };
+        /// Cycle from which on the run loop has to handle interrupts at the next block boundary (NO_EVENT if nothing
+        /// is scheduled or pending)
+        uint64 next_event = NO_EVENT;
 
       public:
+        /// Execution counters
+        CpuStats stats;
+        /// Loggers of this cpu (must outlive it)
+        CpuSinks sinks;
+
         /// Initialize all cpu members and copy the rom into the memory
-        explicit CPU(Rom rom);
+        explicit CPU(std::span<const uint8> rom, const CpuSinks& sinks = {});
+        /// Initialize all cpu members and map the rom of the file into the memory (see `open_rom_file`)
+        explicit CPU(const RomFile& file, const CpuSinks& sinks = {});
+        /// Initialize all cpu members and map the shared rom into the memory, so its pages are only copied when written
+        explicit CPU(const SharedRom& rom, const CpuSinks& sinks = {});
+        ~CPU();
         /// Execute instructions until an error occurs or a hlt instruction is reached
         void run();
+        /// Halt the cpu, so `run` returns after the current instruction (e.g. when called from a sysfunc)
+        inline void halt() { halted = true; }
+        /// Write out the output batched by the sinks (done by `run` before returning); debug output goes first, so
+        /// errors follow the trace that led to them
+        inline void flush_sinks() {
+            sinks.debug->flush();
+            sinks.out->flush();
+            sinks.err->flush();
+        }
         /// Register the given function in the system function table
         void register_sysfunc(const std::string& name, Sysfunc func);
+        /// Register the given function in the system function table, replacing a function registered under its name
+        /// (a function must not replace itself while it runs)
+        void replace_sysfunc(const std::string& name, Sysfunc func);
+        /// Discard all cached decoded instructions (needed after modifying `mem` without `mem_write`)
+        void invalidate_decode_cache();
+
+        /// Capture the registers, random seed, halted / stopped flags and interrupt state, and start saving memory pages
+        /// on their first write, so `restore` only has to copy back the pages written in between
+        /// Writes that bypass `mem_write` are not tracked
+        Snapshot snapshot();
+        /// Reset the cpu to the state of the given snapshot (only the latest snapshot can be restored, any number of
+        /// times; must not be called while the cpu is running)
+        void restore(const Snapshot& snap);
+
+        /// Raise the given interrupt; its handler is called at the next block boundary (jump, call or return) at which
+        /// interrupts are enabled, a stopped cpu continues right away
+        void raise_interrupt(uint32 interrupt);
+        /// Raise the given interrupt after `delay` cycles, and then every `period` cycles if it is not 0
+        void schedule_interrupt(uint32 interrupt, uint64 delay, uint64 period = 0);
+        /// Remove all scheduled raises of the given interrupt
+        void cancel_interrupt(uint32 interrupt);
 
+        /// Make the decoder fuse the given opcode sequence
+        void add_fusion(const Fusion& fusion);
+        /// Get the opcode sequences the decoder currently fuses
+        inline const std::vector<Fusion>& get_fusions() const { return fusions; }
+        /// Start or stop counting which opcodes are executed one after another (disables fusing while active)
+        void set_fusion_profiling(bool enabled);
+        /// Derive up to `count` new fusions from the profiled opcode pairs, most frequent first
+        std::vector<Fusion> derive_fusions(size_t count) const;
+
+        /// Compile blocks entered `threshold` times to native code (does nothing if `TX8_JIT_SUPPORTED` is not defined)
+        /// Must not be called while the cpu is running
+        void enable_jit(uint32 threshold = JIT_DEFAULT_THRESHOLD);
+        /// Go back to interpreting all code (must not be called while the cpu is running)
+        void disable_jit();
+        /// Get the JIT of this cpu (null if disabled)
+        inline const Jit* get_jit() const { return jit.get(); }
+
+        /// Write a value of a fixed size to the specified memory location with a single store (unless the page table
+        /// routes it to a device); bytes past the end of the memory land in the guard band, which is zeroed right away
+        template <ValueSize size>
+        inline void mem_write(mem_addr location, uint32 value) {
+            mem_addr addr = location & MEM_SIZE;
+            uint8*   host = page_table[addr >> BUS_PAGE_BITS];
+            if (host == nullptr) [[unlikely]] {
+                bus_write(addr, value, size);
+                return;
+            }
+
+            auto bytes = (mem_value_t<size>) value;
+            track_write(addr, MIN((uint32) size, MEM_SIZE - addr));
+            memcpy(host + addr, &bytes, sizeof(bytes));
+            memset(mem.data() + MEM_SIZE, 0, sizeof(uint32));
+        }
+        /// Read a value of a fixed size from the specified memory location with a single load (unless the page table
+        /// routes it to a device); bytes past the end of the memory are read from the zeroed guard band
+        template <ValueSize size>
+        inline uint32 mem_read(mem_addr location) {
+            mem_addr addr = location & MEM_SIZE;
+            uint8*   host = page_table[addr >> BUS_PAGE_BITS];
+            if (host == nullptr) [[unlikely]] return bus_read(addr, size);
+
+            mem_value_t<size> value;
+            memcpy(&value, host + addr, sizeof(value));
+            return value;
+        }
         /// Write a value to the specified memory location
-        void mem_write(mem_addr location, uint32 value, ValueSize size = ValueSize::Word);
+        inline void mem_write(mem_addr location, uint32 value, ValueSize size = ValueSize::Word) {
+            switch (size) {
+                case ValueSize::Byte: mem_write<ValueSize::Byte>(location, value); break;
+                case ValueSize::Short: mem_write<ValueSize::Short>(location, value); break;
+                default: mem_write<ValueSize::Word>(location, value); break;
+            }
+        }
         /// Read a value from the specified memory location
-        uint32 mem_read(mem_addr location, ValueSize size = ValueSize::Word);
+        inline uint32 mem_read(mem_addr location, ValueSize size = ValueSize::Word) {
+            switch (size) {
+                case ValueSize::Byte: return mem_read<ValueSize::Byte>(location);
+                case ValueSize::Short: return mem_read<ValueSize::Short>(location);
+                default: return mem_read<ValueSize::Word>(location);
+            }
+        }
         /// Write a value from the specified memory location relative to the O register
         void mem_write_rel(mem_addr location, uint32 value, ValueSize size = ValueSize::Word);
         /// Read a value from the specified memory location relative to the O register
         uint32 mem_read_rel(mem_addr location, ValueSize size = ValueSize::Word);
+        /// Copy `count` bytes (at most the size of the memory) from `src` to `dst` with the same result as a byte by
+        /// byte copy of non overlapping ranges (see `mem_spans`); overlapping ranges are copied like by `memmove`
+        void mem_copy(mem_addr dst, mem_addr src, uint32 count);
+        /// Fill `count` bytes (at most the size of the memory) at `location` with `value` (see `mem_spans`)
+        void mem_set(mem_addr location, uint8 value, uint32 count);
+        /// Check if the `count` bytes at `location` (wrapping like `mem_spans`) can be accessed through `mem` directly,
+        /// i. e. if no device may be affected
+        inline bool mem_direct(mem_addr location, uint32 count) const {
+            return devices.empty() || pages_direct(location, count);
+        }
+
+        /// Map the device to the `count` bytes at `location`, which have to be whole bus pages not mapped to another
+        /// device (the device must outlive the cpu or be unmapped first; must not be called while the cpu is running)
+        void map_device(mem_addr location, uint32 count, Device& device);
+        /// Remove all mappings of the device, so their ranges are plain memory again
+        void unmap_device(const Device& device);
         /// Overwrite the value of the specified cpu register (respects small registers)
         void reg_write(Register which, uint32 value);
         /// Read the value of the specified cpu register (respects small registers)
@@ -93,23 +492,114 @@ namespace tx {
         uint32 top(ValueSize size = ValueSize::Word);
 
         // Convenience function to set the R register
-        inline void write_r(uint32 value) { reg_write(Register::R, value); }
+        inline void write_r(uint32 value) {
+            r         = value;
+            lazy_r.op = Opcode::Invalid;
+        }
         /// Convenience function to set a bit in the r register to a value
-        inline void set_r_bit(uint8 bit, uint8 value) { r = (r & ~(1u << bit)) | (value << bit); }
+        inline void set_r_bit(uint8 bit, uint8 value) {
+            materialize_r();
+            r = (r & ~(1u << bit)) | (value << bit);
+        }
         // Convenience function to read the R register
         inline uint32 read_r() { return reg_read(Register::R); }
+        /// Compute the R register value of the last addition or subtraction if it is still pending
+        /// `run` and sysfunc calls do this, so `r` only has to be materialized explicitly inside of opcode handlers
+        inline void materialize_r() {
+            if (lazy_r.op != Opcode::Invalid) compute_lazy_r();
+        }
 
       private:
+        /// Initialize all cpu members with the given memory (which already holds the rom and ends with the guard band)
+        CPU(Memory memory, const CpuSinks& sinks);
+
         /// Get a random value using the random seed (range 0 - RANDOM_MAX)
         uint32 rand();
 
+        /// Defer setting the R register to the overflow flags of `a op b` (Opcode::Add or Opcode::Sub) until it is read
+        inline void set_lazy_r(Opcode op, ValueSize size, uint32 a, uint32 b) { lazy_r = {op, size, a, b}; }
+        /// Write the overflow flags of the pending operation to the R register
+        void compute_lazy_r();
+
         /// Parse an instruction from the given memory address
         Instruction parse_instruction(mem_addr pc);
+        /// Get the parsed instruction at the given memory address, parsing and caching it on first use
+        const DecodedInstruction& decode(mem_addr pc);
+        /// Get the cache slot of the given memory address, parsing the instruction if the slot is empty (does not look
+        /// for fusions)
+        DecodedInstruction& decode_slot(mem_addr pc);
+        /// Select the handler for an instruction, preferring a specialization for its parameter modes
+        OpHandler select_handler(const Instruction& inst);
+        /// Look for a fusion starting at the given slot and set its entry handler accordingly
+        void fuse(mem_addr pc, DecodedInstruction& slot);
+        /// Select the handler for the fusion of an instruction handled by `first` with the following jump
+        OpHandler select_fused_jump(OpHandler first, const DecodedInstruction& jump);
+        /// Save the pages overlapping the `count` bytes about to be written at `location` for the latest snapshot
+        void save_pages(mem_addr location, uint32 count);
+        /// Discard cached instructions overlapping the `count` bytes written at `location`
+        void invalidate_decoded(mem_addr location, uint32 count);
+        /// Read the four float32 lanes of a vector operand at `location` (like four word loads)
+        Vec4 vec_read(mem_addr location);
+        /// Write the four float32 lanes of a vector operand to `location` (like four word stores)
+        void vec_write(mem_addr location, const Vec4& vec);
+        /// Handle interrupts at a block boundary reached from the instruction (or compiled block) at `from` if an
+        /// interrupt is due (see `next_event`), or skip an idle loop if one is scheduled
+        inline void poll_interrupts(mem_addr from) {
+            if (stats.cycles() >= next_event) [[unlikely]] handle_interrupts();
+            // only jumping backwards can close a loop
+            else if (p <= from && next_event != NO_EVENT) [[unlikely]] check_idle_loop(from);
+        }
+        /// Raise the due scheduled interrupts and call the handler of the first pending interrupt if enabled
+        void handle_interrupts();
+        /// Skip the cycles until the next scheduled interrupt of a stopped cpu and raise it; returns false if no
+        /// interrupt can wake the cpu anymore
+        bool wait_for_interrupt();
+        /// Skip the cycles up to the next scheduled interrupt if the jump from `from` back to `p` ended an iteration of a
+        /// loop without side effects which left all registers as they were
+        void check_idle_loop(mem_addr from);
+        /// Check if the loop starting at `start` only modifies registers
+        IdleLoop examine_loop(mem_addr start);
+        /// Recompute `next_event` after the interrupt state changed
+        void update_next_event();
+        /// Find the mapping of the device at the given location (null if it is plain memory)
+        const DeviceMapping* device_at(mem_addr location) const;
+        /// Read from the given location (already wrapped) through the mapped devices, slow path of `mem_read`
+        uint32 bus_read(mem_addr location, ValueSize size);
+        /// Write to the given location (already wrapped) through the mapped devices, slow path of `mem_write`
+        void bus_write(mem_addr location, uint32 value, ValueSize size);
+        /// Check the page table entries of all pages overlapping the `count` bytes at `location` (see `mem_direct`)
+        bool pages_direct(mem_addr location, uint32 count) const;
+        /// Fill the page table entries according to the mapped devices
+        void update_page_table();
+        /// Save snapshot pages and discard cached instructions for the `count` bytes about to be written at `location`
+        /// (the range must lie inside of the memory)
+        inline void track_write(mem_addr location, uint32 count) {
+            if (snapshot_pages != nullptr) save_pages(location, count);
+
+            // only pay for invalidation if the write touches a page holding cached instructions
+            if (count != 0 && has_code(location, location + count - 1)) {
+                ++stats.code_writes;
+                invalidate_decoded(location, count);
+            }
+        }
+        /// Mark the pages overlapping the addresses [first, last] as holding decoded or compiled instructions
+        inline void mark_code(mem_addr first, mem_addr last) {
+            for (uint32 page = first >> DECODE_PAGE_BITS; page <= last >> DECODE_PAGE_BITS; ++page)
+                code_pages[page / 64] |= 1ULL << (page % 64);
+        }
+        /// Check if any page overlapping the addresses [first, last] holds decoded or compiled instructions
+        inline bool has_code(mem_addr first, mem_addr last) const {
+            for (uint32 page = first >> DECODE_PAGE_BITS; page <= last >> DECODE_PAGE_BITS; ++page)
+                if ((code_pages[page / 64] >> (page % 64)) & 1U) return true;
+            return false;
+        }
         /// Execute the given parsed instruction
         void exec_instruction(Instruction instruction);
 
         /// Execute the system function specified by its id (the hash of the string name)
         void exec_sysfunc(uint32 hashed_name);
+        /// Rewrite a `sys` instruction with a constant id to call its system function by index (see `op_sys_indexed`)
+        void resolve_sysfunc(DecodedInstruction& slot);
 
         /// Get the raw numerical value of a parameter using its mode
         uint32 get_param_value(Parameter param);
@@ -126,7 +616,7 @@ namespace tx {
         /// Print an error message and halt the cpu (sets `halted` to true)
         template <typename... Args>
         void error_raw(fmt::format_string<Args...> format, Args... args) {
-            tx::log_err(format, std::forward<Args>(args)...);
+            (*sinks.err)(format, std::forward<Args>(args)...);
             halted = true;
         }
         /// Same as `error_raw`, but prints the instruction the cpu is currently executing
@@ -136,8 +626,8 @@ namespace tx {
             error_raw(format, std::forward<Args>(args)...);
 
             Instruction current_instruction = parse_instruction(p);
-            tx::log_err("\nCaused by instruction:\n");
-            tx::log_err("[#{:x}] {}\n", p, current_instruction);
+            (*sinks.err)("\nCaused by instruction:\n");
+            (*sinks.err)("[#{:x}] {}\n", p, current_instruction);
         }
 
         // All opcode handler functions
@@ -157,6 +647,8 @@ namespace tx {
         void op_call(const Parameters& params);
         void op_ret(const Parameters& params);
         void op_sys(const Parameters& params);
+        /// `sys` with the index of the system function in the (otherwise unused) second parameter
+        void op_sys_indexed(const Parameters& params);
 
         void op_ld(const Parameters& params);
         void op_lds(const Parameters& params);
@@ -225,6 +717,14 @@ namespace tx {
         void op_log(const Parameters& params);
         void op_log2(const Parameters& params);
         void op_log10(const Parameters& params);
+        void op_mcpy(const Parameters& params);
+        void op_mset(const Parameters& params);
+        void op_vadd(const Parameters& params);
+        void op_vmul(const Parameters& params);
+        void op_vfma(const Parameters& params);
+        void op_vdot(const Parameters& params);
+        void op_vmin(const Parameters& params);
+        void op_vmax(const Parameters& params);
 
         void op_uadd(const Parameters& params);
         void op_usub(const Parameters& params);
@@ -247,42 +747,45 @@ namespace tx {
         /// Opcode handler function for invalid opcodes
         void op_inv(const Parameters& params);
 
-        // clang-format off
+        /// Execute `count` consecutive instructions starting at the program counter with a single dispatch
+        template <uint32 count>
+        void op_fused(const Parameters& params);
+        /// Execute the instruction handled by `first` directly followed by the conditional jump `jump`
+        template <OpHandler first, Opcode jump>
+        void op_fused_jump(const Parameters& params);
+
+        /// Opcode handler specialized for fixed parameter modes and destination register size (see `select_handler`)
+        template <Opcode op, ParamMode mode_p1, ParamMode mode_p2, ValueSize size>
+        void op_spec(const Parameters& params);
+
         /// Mapping of opcodes to their handler functions
-        const std::array<std::function<void (CPU*, const Parameters& params)>, 256> op_function = {
-            // 0x0
-            &CPU::op_hlt, &CPU::op_nop, &CPU::op_jmp, &CPU::op_jeq, &CPU::op_jne, &CPU::op_jgt, &CPU::op_jge, &CPU::op_jlt, &CPU::op_jle, &CPU::op_cmp, &CPU::op_fcmp, &CPU::op_ucmp, &CPU::op_call, &CPU::op_ret, &CPU::op_sys, &CPU::op_inv,
-            // 0x1
-            &CPU::op_ld, &CPU::op_lds, &CPU::op_lw, &CPU::op_lws, &CPU::op_lda, &CPU::op_sta, &CPU::op_ldb, &CPU::op_stb, &CPU::op_ldc, &CPU::op_stc, &CPU::op_ldd, &CPU::op_std, &CPU::op_zero, &CPU::op_push, &CPU::op_pop, &CPU::op_inv,
-            // 0x2
-            &CPU::op_inc, &CPU::op_dec, &CPU::op_add, &CPU::op_sub, &CPU::op_mul, &CPU::op_div, &CPU::op_mod, &CPU::op_max, &CPU::op_min, &CPU::op_abs, &CPU::op_sign, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0x3
-            &CPU::op_and, &CPU::op_or, &CPU::op_not, &CPU::op_nand, &CPU::op_xor, &CPU::op_slr, &CPU::op_sar, &CPU::op_sll, &CPU::op_ror, &CPU::op_rol, &CPU::op_set, &CPU::op_clr, &CPU::op_tgl, &CPU::op_test, &CPU::op_inv,  &CPU::op_inv,
-            // 0x4
-            &CPU::op_finc, &CPU::op_fdec, &CPU::op_fadd, &CPU::op_fsub, &CPU::op_fmul, &CPU::op_fdiv, &CPU::op_fmod, &CPU::op_fmax, &CPU::op_fmin, &CPU::op_fabs, &CPU::op_fsign, &CPU::op_sin, &CPU::op_cos, &CPU::op_tan, &CPU::op_asin, &CPU::op_acos,
-            // 0x5
-            &CPU::op_atan, &CPU::op_atan2, &CPU::op_sqrt, &CPU::op_pow, &CPU::op_exp, &CPU::op_log, &CPU::op_log2, &CPU::op_log10, &CPU::op_inv,  &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0x6
-            &CPU::op_uadd, &CPU::op_usub, &CPU::op_umul, &CPU::op_udiv, &CPU::op_umod, &CPU::op_umax, &CPU::op_umin, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0x7
-            &CPU::op_rand, &CPU::op_rseed, &CPU::op_itf, &CPU::op_fti, &CPU::op_utf, &CPU::op_ftu, &CPU::op_ei, &CPU::op_di, &CPU::op_stop, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0x8
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0x9
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0xa
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0xb
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0xc
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0xd
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0xe
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-            // 0xf
-            &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
-        };
-        // clang-format on
+        static const std::array<OpHandler, 256> op_handlers;
+#ifdef TX8_DISPATCH_FUNCTION
+        /// Reference dispatch engine: per instance type-erased copies of `op_handlers`
+        const std::array<std::function<void(CPU*, const Parameters& params)>, 256> op_function;
+#endif
+
+        // idle loop detection only runs while interrupts are scheduled, so its state stays out of the hot members above
+        /// Recently checked loops, indexed by a hash of their start
+        std::array<IdleLoop, IDLE_LOOP_CACHE_SIZE> idle_loops;
+        /// Start of the loop `idle_registers` were captured for
+        mem_addr idle_start = 0;
+        /// Registers at the latest jump back to `idle_start`
+        std::array<uint32, REGISTER_COUNT> idle_registers = {};
+        /// If only the loop at `idle_start` ran since capturing `idle_registers`
+        bool idle_armed = false;
     };
 } // namespace tx
+
+template <>
+struct fmt::formatter<tx::Fusion> : fmt::formatter<string_view> {
+    template <typename FormatContext>
+    auto format(const tx::Fusion& fusion, FormatContext& ctx) {
+        std::string s;
+        for (tx::uint32 i = 0; i < fusion.length; ++i) {
+            if (i > 0) s += " ";
+            s += tx::op_names[(tx::uint32) fusion.ops[i]];
+        }
+        return formatter<string_view>::format(s, ctx);
+    }
+};
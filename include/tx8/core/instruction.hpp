@@ -106,6 +106,14 @@ namespace tx {
         Log   = 0x55,
         Log2  = 0x56,
         Log10 = 0x57,
+        Mcpy  = 0x58,
+        Mset  = 0x59,
+        Vadd  = 0x5a,
+        Vmul  = 0x5b,
+        Vfma  = 0x5c,
+        Vdot  = 0x5d,
+        Vmin  = 0x5e,
+        Vmax  = 0x5f,
 
         Uadd = 0x60,
         Usub = 0x61,
@@ -206,7 +214,7 @@ namespace tx {
         // 0x4
         "finc",  "fdec",  "fadd",  "fsub",  "fmul",  "fdiv",  "fmod",  "fmax",  "fmin",  "fabs",  "fsign", "sin",   "cos",   "tan",   "asin",   "acos",
         // 0x5
-        "atan",  "atan2", "sqrt",  "pow",   "exp",   "log",   "log2",  "log10", "IN_58", "IN_59", "IN_5a", "IN_5b", "IN_5c", "IN_5d", "IN_5e", "IN_5f",
+        "atan",  "atan2", "sqrt",  "pow",   "exp",   "log",   "log2",  "log10", "mcpy",  "mset",  "vadd",  "vmul",  "vfma",  "vdot",  "vmin",  "vmax",
         // 0x6
         "uadd",  "usub",  "umul",  "udiv",  "umod",  "umax",  "umin",  "IN_67", "IN_68", "IN_69", "IN_6a", "IN_6b", "IN_6c", "IN_6d", "IN_6e", "IN_6f",
         // 0x7
@@ -407,7 +415,7 @@ namespace tx {
         // 0x4
         1, 1, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
         // 0x5
-        1, 2, 1, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 2, 1, 2, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2,
         // 0x6
         2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
         // 0x7
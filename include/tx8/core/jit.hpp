@@ -0,0 +1,105 @@
+/**
+ * @file jit.hpp
+ * @brief JIT compiler translating hot blocks of tx8 code to x86-64 machine code.
+ * @details The run loop of a cpu with an enabled JIT counts how often it enters each block (the straight-line code
+ * starting at a jump target) and compiles blocks entered `threshold` times. Compiled blocks keep the tx8 registers in
+ * host registers and execute common register and memory load instructions natively. All other instructions, memory
+ * accesses outside of the fast path and sysfuncs call back into the cpu, so the interpreter stays the reference
+ * implementation. Only available on x86-64 Linux, see `TX8_JIT_SUPPORTED`.
+ */
+#pragma once
+
+#include "tx8/core/cpu.hpp"
+#include "tx8/core/instruction.hpp"
+#include "tx8/core/types.hpp"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(TX8_NO_JIT)
+/// Defined if the JIT can generate and execute code on this platform
+#define TX8_JIT_SUPPORTED
+#endif
+
+namespace tx {
+    /// The maximum number of instructions compiled into one block
+    const uint32 JIT_MAX_BLOCK_LENGTH = 64;
+    /// The size of the executable code buffer of one JIT in bytes
+    const uint32 JIT_BUFFER_SIZE = 0x400000U;
+
+    /// A compiled block, called with the cpu registers, the cpu memory and the cpu itself
+    using JitBlock = void (*)(uint32* registers, uint8* mem, CPU* cpu);
+
+    /// An instruction a compiled block executes by calling back into its handler
+    struct JitCall {
+        Instruction inst;
+        OpHandler   handler;
+        mem_addr    addr;
+    };
+
+    /// @brief Compiles and executes hot blocks of the code of one cpu
+    class Jit {
+      public:
+        /// Create a JIT for the given cpu, compiling blocks after `threshold` entries
+        Jit(CPU& cpu, uint32 threshold);
+        ~Jit();
+        Jit(const Jit&)            = delete;
+        Jit& operator=(const Jit&) = delete;
+
+        /// Count an entry into the block at the program counter, compiling it if it became hot, and execute it if it is
+        /// compiled; returns false if the interpreter has to continue instead
+        bool enter();
+        /// Discard all compiled blocks overlapping the memory range [first, last]
+        void invalidate(mem_addr first, mem_addr last);
+        /// Discard all compiled blocks
+        void invalidate_all();
+
+        /// Number of blocks compiled so far
+        inline uint32 get_compiled_count() const { return compiled; }
+        /// Number of instructions compiled blocks call back into the cpu for
+        inline size_t get_call_count() const { return calls.size(); }
+
+      private:
+        /// Compilation state of a block start address
+        struct Entry {
+            /// Number of entries into the block so far
+            uint32 count = 0;
+            /// Compiled code (null if not compiled yet)
+            JitBlock code = nullptr;
+            /// Address right after the last compiled instruction
+            mem_addr end = 0;
+            /// If the block is not worth compiling (no instruction could be translated)
+            bool failed = false;
+        };
+
+        CPU&   cpu;
+        uint32 threshold;
+        /// Block entries by start address
+        std::unordered_map<mem_addr, Entry> entries;
+        /// Instructions compiled blocks call back into (a deque, so pointers stay valid)
+        std::deque<JitCall> calls;
+        /// Pages of the decoded instruction cache size containing compiled code
+        std::vector<bool> code_pages;
+        /// Executable code buffer
+        uint8* buffer = nullptr;
+        /// Number of used bytes in `buffer`
+        size_t used = 0;
+        /// Incremented whenever compiled code is discarded, so running blocks can notice
+        uint32 generation = 0;
+        /// Number of compiled blocks
+        uint32 compiled = 0;
+
+        /// Compile the block starting at `start` into `entry`; returns false if the code buffer is full
+        bool compile(mem_addr start, Entry& entry);
+        /// Discard all compiled code, freeing the code buffer (only while no block is running)
+        void flush();
+        /// Copy generated code into the code buffer, returning null if it is full
+        JitBlock install(const std::vector<uint8>& code);
+
+        /// Execute an instruction for a compiled block; returns non-zero if the block has to exit
+        static uint32 exec(CPU* cpu, const JitCall* call);
+        /// Read a memory word for a compiled block
+        static uint32 read(CPU* cpu, mem_addr location);
+    };
+} // namespace tx
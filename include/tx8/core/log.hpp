@@ -7,7 +7,19 @@
  * Normal output (such as a `print` syscall from a tx8 program) is logged normally. Errors and
  * debug output is logged via their own `Log` instances `log_err` and `log_debug`. If logging to strings is enabled,
  * the aggregated logs can be retrieved via `tx::Log::get_str` and cleared via
- * `tx::Log::clear_str`.
+ * `tx::Log::clear_str`. The global loggers are the default sinks of every cpu; a cpu can be given its own loggers
+ * instead (see `tx::CpuSinks`).
+ *
+ * Messages are formatted into a buffer owned by the logger, so logging does not allocate once the buffer has grown
+ * to its working size. String and function sinks receive every message immediately, while output for streams and
+ * files is collected and written in batches: when the buffer exceeds the flush threshold, on `tx::Log::flush`, and
+ * when a cpu stops running (see `tx::CPU::run`).
+ *
+ * In async mode (see `tx::Log::init_async`), flushing only hands the batch to a writer thread through a lock-free ring
+ * and the writer thread performs the writes to the stream, file and function sinks, so the logging thread does not
+ * wait for I/O. When the ring is full, the logger either waits for the writer thread or drops the batch, depending on
+ * its `tx::LogOverflow` policy. Everything handed over is written before `tx::Log::sync` returns and before the logger
+ * is reset or destroyed.
  */
 #pragma once
 
@@ -15,17 +27,31 @@
 // #include <format>
 #include <fmt/format.h>
 #include <iostream>
+#include <memory>
 #include <string>
 
 using tx_logfunc_ptr = void (*)(const std::string& s);
 
 namespace tx {
+    /// What an asynchronous logger does with a batch that does not fit into its full ring
+    enum class LogOverflow {
+        /// Wait until the writer thread has made room (no output is lost)
+        Wait,
+        /// Discard the batch and count its bytes (see `tx::Log::dropped`)
+        Drop,
+    };
+
     class Log { // NOLINT
       private:
         bool enabled = false;
 
       public:
-        /// Reset the logger to its initial state
+        /// Default number of buffered bytes after which stream and file output is written
+        static constexpr size_t FLUSH_THRESHOLD = 8192;
+        /// Default capacity of the ring between an asynchronous logger and its writer thread in bytes
+        static constexpr size_t ASYNC_CAPACITY = 1U << 20U;
+
+        /// Reset the logger to its initial state (writing out buffered output first)
         void reset();
 
         Log();
@@ -35,13 +61,33 @@ namespace tx {
         template <typename... Args>
         void operator()(fmt::format_string<Args...> format, Args&&... args) {
             if (!enabled) return;
-            std::string s = fmt::format(format, std::forward<Args>(args)...);
+            size_t start = buffer.size();
+            fmt::format_to(fmt::appender(buffer), format, std::forward<Args>(args)...);
+
+            if (str != nullptr) str->append(buffer.data() + start, buffer.size() - start);
+            if (func != nullptr && async == nullptr) func(std::string(buffer.data() + start, buffer.size() - start));
+
+            if (!batched()) buffer.clear();
+            else if (buffer.size() >= flush_threshold) flush();
+        }
+
+        /// Write the buffered output to the stream and file sinks (or hand it to the writer thread in async mode)
+        void flush();
 
-            if (stream != nullptr) *stream << s;
-            if (str != nullptr) str->append(s);
+        /// Write stream, file and function output on a writer thread, which receives the batches through a ring of
+        /// `capacity` bytes (rounded up to a power of two); function sinks then receive whole batches
+        void init_async(size_t capacity = ASYNC_CAPACITY, LogOverflow overflow = LogOverflow::Wait);
 
-            if (file != nullptr) fprintf(file, "%s", s.c_str()); // NOLINT
-            if (func != nullptr) func(s);
+        /// Flush and wait until the writer thread has written everything (only flushes if not in async mode)
+        void sync();
+
+        /// Number of bytes discarded because the ring was full (only with `LogOverflow::Drop`)
+        size_t dropped() const;
+
+        /// Set the number of buffered bytes after which stream and file output is written (0 writes every message)
+        inline void set_flush_threshold(size_t threshold) {
+            flush_threshold = threshold;
+            if (buffer.size() >= flush_threshold) flush();
         }
 
         /// Get if logger is active
@@ -54,12 +100,14 @@ namespace tx {
 
         /// Normal logs go to stream
         inline void init_stream(std::ostream* strm) {
+            sync();
             enabled = true;
             stream  = strm;
         }
 
         /// Normal logs go to a file
         inline void init_file(FILE* f) {
+            sync();
             enabled = true;
             file    = f;
         }
@@ -73,6 +121,7 @@ namespace tx {
 
         /// Normal logs call the given function
         inline void init_func(tx_logfunc_ptr fun) {
+            sync();
             enabled = true;
             func    = fun;
         }
@@ -81,10 +130,26 @@ namespace tx {
         inline std::string get_str() { return *str; }
 
       private:
+        class AsyncWriter;
+
+        /// If messages are collected in the buffer instead of being discarded after the immediate sinks received them
+        inline bool batched() const {
+            return stream != nullptr || file != nullptr || (func != nullptr && async != nullptr);
+        }
+
+        /// Write output to the stream and file sinks
+        void write(const char* data, size_t size);
+
         std::ostream*  stream = nullptr;
         FILE*          file   = nullptr;
         std::string*   str    = nullptr;
         tx_logfunc_ptr func   = nullptr;
+
+        /// Formatted messages not yet written to the stream and file sinks
+        fmt::memory_buffer buffer;
+        size_t             flush_threshold = FLUSH_THRESHOLD;
+        /// Writer thread in async mode
+        std::unique_ptr<AsyncWriter> async;
     };
 
     extern Log log;
@@ -0,0 +1,100 @@
+/**
+ * @file memory.hpp
+ * @brief Zero initialized guest memory backed by an anonymous mapping.
+ * @details The operating system hands out zeroed pages on first touch, so creating a `tx::Memory` takes constant
+ * time regardless of its size and resident memory only grows with the pages a program actually touches. Ranges that
+ * are filled right away (like the rom) can request transparent huge pages on Linux, unless `TX8_NO_HUGE_PAGES` is
+ * defined. Rom files and `tx::SharedRom`s can be mapped in directly, so loading them does not copy the rom either and
+ * all memories holding the same rom share its pages until they are written to. Platforms without `mmap` fall back to
+ * `calloc`.
+ */
+#pragma once
+
+#include "tx8/core/types.hpp"
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace tx {
+    /// @brief A rom held in shared memory once, for many memories to map copy on write instead of copying it
+    /// @details Uses a memfd on Linux, elsewhere the rom is kept in a vector and copied into each memory.
+    class SharedRom {
+      public:
+        /// Copy the rom into shared memory
+        explicit SharedRom(std::span<const uint8> rom);
+        ~SharedRom();
+        SharedRom(const SharedRom&)            = delete;
+        SharedRom& operator=(const SharedRom&) = delete;
+
+        /// The rom bytes
+        inline std::span<const uint8> data() const { return {view, length}; }
+        inline size_t                 size() const { return length; }
+
+      private:
+        friend class Memory;
+
+        /// File descriptor of the shared memory (-1 if it is not available)
+        int fd = -1;
+        /// Start of the rom bytes (a read only mapping of `fd` or the data of `fallback`)
+        const uint8* view = nullptr;
+        /// Size of the rom in bytes
+        size_t length = 0;
+        /// The rom bytes if shared memory is not available
+        std::vector<uint8> fallback;
+    };
+
+    /// @brief A zero initialized, fixed size block of memory that is allocated lazily page by page
+    class Memory {
+      public:
+        /// Map `size` bytes of zeroed memory
+        explicit Memory(size_t size);
+        /// Map `size` bytes of zeroed memory with `count` bytes of the file at `path`, starting at `file_offset`,
+        /// placed at `offset`. The file is mapped copy on write where possible, so it is only read when a page is
+        /// touched and writes never reach it. Otherwise, the bytes are read into the memory.
+        Memory(size_t size, size_t offset, const std::string& path, size_t file_offset, size_t count);
+        /// Map `size` bytes of zeroed memory with the shared rom placed at `offset`, copy on write where possible
+        Memory(size_t size, size_t offset, const SharedRom& rom);
+        ~Memory();
+        Memory(const Memory&)            = delete;
+        Memory& operator=(const Memory&) = delete;
+        Memory(Memory&& other) noexcept;
+        Memory& operator=(Memory&& other) noexcept;
+
+        inline uint8*       data() { return ptr; }
+        inline const uint8* data() const { return ptr; }
+        inline size_t       size() const { return length; }
+
+        inline uint8&       operator[](size_t index) { return ptr[index]; }
+        inline const uint8& operator[](size_t index) const { return ptr[index]; }
+
+        /// Request huge pages for the huge page aligned parts of the given range (only worth it for ranges that are
+        /// filled right away, as the os zeroes a whole huge page on first touch)
+        void use_huge_pages(size_t offset, size_t size);
+
+        inline uint8*       begin() { return ptr; }
+        inline uint8*       end() { return ptr + length; }
+        inline const uint8* begin() const { return ptr; }
+        inline const uint8* end() const { return ptr + length; }
+
+      private:
+        /// Start of the memory (null if it was moved from)
+        uint8* ptr = nullptr;
+        /// Usable size in bytes
+        size_t length = 0;
+        /// Start of the mapping, which may begin before `ptr` to align it to huge pages or a mapped file
+        uint8* mapping = nullptr;
+        /// Size of the mapping in bytes
+        size_t mapped = 0;
+
+        /// Allocate the memory, placing `ptr` `shift` bytes after a page boundary
+        void allocate(size_t shift);
+        /// Map the file region over the memory, returns false if that is not possible
+        bool map_file(size_t offset, const std::string& path, size_t file_offset, size_t count);
+        /// Map the region of the open file over the memory, returns false if that is not possible
+        bool map_fd(size_t offset, int fd, size_t file_offset, size_t count);
+        /// Release the memory
+        void release();
+    };
+} // namespace tx
@@ -16,6 +16,7 @@ namespace tx {
     using int16   = int16_t;
     using uint32  = uint32_t;
     using int32   = int32_t;
+    using uint64  = uint64_t;
     using float32 = float;
 
     using mem_addr = uint32;
@@ -28,6 +28,14 @@ namespace tx {
         std::string description;
     };
 
+    /// A tx8 rom file, whose rom can be mapped into memory instead of being read
+    struct RomFile {
+        std::string path;
+        RomInfo     info;
+        /// Position of the rom in the file (the size of the header)
+        size_t offset;
+    };
+
     /// Calculate a hash value for a string
     static inline uint32 str_hash(const std::string& str) {
         const char* s = str.c_str();
@@ -40,6 +48,9 @@ namespace tx {
     /// Parse a tx8 rom header from a stream
     /// Returns `nullopt` if the header is invalid, e. g. the checksum is wrong or the magic bytes are invalid
     std::optional<RomInfo> parse_header(std::istream& stream);
+    /// Parse the header of the rom file at `path`
+    /// Returns `nullopt` if the header is invalid or the file is shorter than the rom size it states
+    std::optional<RomFile> open_rom_file(const std::string& path);
     /// Builds the binary representation of a tx8 rom header from a `RomInfo` struct
     /// This automatically calculates the checksum
     /// Truncates names and descriptions that are longer than their maximum length (256 / 65536 bytes)
@@ -1,27 +1,45 @@
 #include "tx8/asm/assembler.hpp"
+#include "tx8/core/aot.hpp"
+#include "tx8/core/batch.hpp"
 #include "tx8/core/cpu.hpp"
 #include "tx8/core/stdlib.hpp"
 #include "tx8/core/util.hpp"
 
 #include <CLI/CLI.hpp>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fmt/format.h>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TX8_CLI_FORK
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 static tx::Log log_cli;
 
-void cmd_run(const std::string& fname) {
+/// Load a rom from a binary file or assemble it from a source file, logging `action` and the file
+tx::Rom load_rom(const std::string& fname, const std::string& action) {
     std::ifstream file(fname, std::ios::in);
     auto          rominfo = tx::parse_header(file);
 
     tx::Rom rom;
 
     if (rominfo.has_value()) {
-        log_cli("Running {}\n", rominfo.value());
+        log_cli("{} {}\n", action, rominfo.value());
         rom.resize(rominfo.value().size);
         file.read((char*) rom.data(), (long) rom.size());
     } else {
-        log_cli("Running source file {}\n", fname);
+        log_cli("{} source file {}\n", action, fname);
         file.seekg(0);
 
         tx::Assembler as(file);
@@ -34,12 +52,223 @@ void cmd_run(const std::string& fname) {
     }
 
     file.close();
+    return rom;
+}
+
+/// Create a cpu running a rom file or source file, logging `action` and the file
+/// Rom files are mapped into the cpu memory instead of being read, source files are assembled
+std::unique_ptr<tx::CPU> load_cpu(const std::string& fname, const std::string& action) {
+    auto rom_file = tx::open_rom_file(fname);
+    if (!rom_file.has_value()) return std::make_unique<tx::CPU>(load_rom(fname, action));
+
+    log_cli("{} {}\n", action, rom_file.value().info);
+    return std::make_unique<tx::CPU>(rom_file.value());
+}
 
-    tx::CPU cpu(rom);
+void cmd_run(const std::string& fname, size_t profile_fusions, bool jit, bool async_output, bool stats) {
+    auto cpu = load_cpu(fname, "Running");
+    if (async_output) tx::log.init_async();
 
-    tx::stdlib::use_stdlib(cpu);
+    tx::stdlib::use_stdlib(*cpu);
+    if (profile_fusions > 0) cpu->set_fusion_profiling(true);
+    if (jit) cpu->enable_jit();
 
-    cpu.run();
+    cpu->run();
+    // the rom output goes before the cli output
+    tx::log.sync();
+
+    if (profile_fusions > 0) {
+        for (const auto& fusion : cpu->derive_fusions(profile_fusions)) log_cli("Fusion candidate: {}\n", fusion);
+    }
+    if (stats) {
+        log_cli("Instructions: {}\n", cpu->stats.instructions());
+        log_cli("Writes to code pages: {}\n", cpu->stats.code_writes);
+        log_cli("Code invalidations: {}\n", cpu->stats.invalidations);
+        log_cli("Interrupts: {} ({} idle cycles)\n", cpu->stats.interrupts, cpu->stats.idle);
+        log_cli("Skipped idle loops: {}\n", cpu->stats.idle_loops);
+    }
+}
+
+/// Result the fuzz server writes for every input
+struct FuzzResult {
+    /// One of the FUZZ_* statuses
+    tx::uint32 status;
+    /// Value of the A register when the rom halted
+    tx::uint32 a;
+    /// Value of the P register when the rom halted
+    tx::uint32 p;
+    /// Number of instructions executed for the input
+    tx::uint64 instructions;
+};
+
+/// Fuzz result status: the rom halted
+const tx::uint32 FUZZ_HALTED = 0;
+/// Fuzz result status: the rom halted with an error
+const tx::uint32 FUZZ_ERROR = 1;
+/// Fuzz result status: the process running the input crashed (only when forking)
+const tx::uint32 FUZZ_CRASHED = 2;
+
+/// Read the next fuzz input from stdin (a 32 bit length followed by the bytes), returns false at the end of stdin
+bool read_fuzz_input(std::vector<tx::uint8>& input) {
+    tx::uint32 length;
+    if (fread(&length, sizeof(length), 1, stdin) != 1) return false;
+    input.resize(length);
+    return fread(input.data(), 1, length, stdin) == length;
+}
+
+/// Write a fuzz result to stdout (the fields in order, without padding)
+void write_fuzz_result(const FuzzResult& result) {
+    std::array<tx::uint8, 20> buffer;
+    memcpy(buffer.data(), &result.status, 4);
+    memcpy(buffer.data() + 4, &result.a, 4);
+    memcpy(buffer.data() + 8, &result.p, 4);
+    memcpy(buffer.data() + 12, &result.instructions, 8);
+    fwrite(buffer.data(), 1, buffer.size(), stdout);
+    fflush(stdout);
+}
+
+/// Build the fuzz result of a cpu that halted after executing `instructions` instructions for the input
+FuzzResult fuzz_result(const tx::CPU& cpu, tx::uint64 instructions) {
+    tx::uint32 status = tx::log_err.get_str().empty() ? FUZZ_HALTED : FUZZ_ERROR;
+    return {status, cpu.a, cpu.p, instructions};
+}
+
+#ifdef TX8_CLI_FORK
+/// Fork a child for every input and report the children that crash, exits at the end of stdin
+/// Returns in the children, which continue with the input
+void fork_server(std::vector<tx::uint8>& input) {
+    while (read_fuzz_input(input)) {
+        pid_t pid = fork();
+        if (pid == 0) return;
+
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            write_fuzz_result({FUZZ_CRASHED, 0, 0, 0});
+    }
+    exit(0);
+}
+#endif
+
+void cmd_fuzz(const std::string& fname, bool use_fork, bool jit) {
+#ifndef TX8_CLI_FORK
+    if (use_fork) {
+        fmt::println("Forking is not supported on this platform");
+        exit(1);
+    }
+#endif
+    // stdout carries the results, so guest and cli output is discarded, errors are collected to report them
+    log_cli.reset();
+    auto cpu = load_cpu(fname, "Fuzzing");
+    tx::log.reset();
+    tx::log_err.reset();
+    tx::log_err.init_str();
+
+    tx::stdlib::use_stdlib(*cpu);
+    if (jit) cpu->enable_jit();
+
+    // the rom runs until it first calls `get`, every input continues from there
+    std::vector<tx::uint8>      input;
+    size_t                      consumed = 0;
+    bool                        reached  = false;
+    tx::uint64                  start    = 0;
+    std::optional<tx::Snapshot> snap;
+    cpu->replace_sysfunc("get", [&](tx::CPU& cpu) {
+        if (!reached) {
+            reached = true;
+            start   = cpu.stats.instructions() - 1; // this `get` is counted as part of every input
+#ifdef TX8_CLI_FORK
+            if (use_fork) fork_server(input);
+#endif
+            if (!use_fork) {
+                // restoring the snapshot executes this `get` again
+                snap = cpu.snapshot();
+                cpu.halt();
+                return;
+            }
+        }
+        char c = consumed < input.size() ? (char) input[consumed++] : (char) EOF;
+        cpu.push(c, tx::ValueSize::Byte);
+    });
+
+    cpu->run();
+
+    if (use_fork && reached) {
+        // a forked child
+        write_fuzz_result(fuzz_result(*cpu, cpu->stats.instructions() - start));
+        _exit(0);
+    }
+
+    // the rom does not read any input, so every input has the same result
+    FuzzResult result = fuzz_result(*cpu, cpu->stats.instructions());
+    while (read_fuzz_input(input)) {
+        if (reached) {
+            consumed = 0;
+            tx::log_err.clear_str();
+            cpu->restore(snap.value());
+            start = cpu->stats.instructions();
+            cpu->run();
+            result = fuzz_result(*cpu, cpu->stats.instructions() - start);
+        }
+        write_fuzz_result(result);
+    }
+}
+
+void cmd_batch(
+    const std::vector<std::string>& files,
+    const std::string&              jobs_file,
+    size_t                          threads,
+    const std::string&              destName
+) {
+    // JSON lines written to stdout must not be mixed with cli output
+    if (destName.empty()) log_cli.reset();
+
+    std::vector<std::pair<std::string, std::string>> specs;
+    for (const auto& file : files) specs.emplace_back(file, "");
+    if (!jobs_file.empty()) {
+        // one job per line: the rom and optionally a file containing its input
+        std::ifstream list(jobs_file, std::ios::in);
+        std::string   line;
+        while (std::getline(list, line)) {
+            std::istringstream fields(line);
+            std::string        rom, input;
+            if (fields >> rom) {
+                fields >> input;
+                specs.emplace_back(rom, input);
+            }
+        }
+    }
+
+    // rom files are loaded by the pool, source files are assembled once up front
+    std::vector<tx::batch::Job>                                 jobs;
+    std::map<std::string, std::shared_ptr<const tx::SharedRom>> assembled;
+    for (const auto& [rom, input_file] : specs) {
+        tx::batch::Job job {rom, "", nullptr};
+        if (!input_file.empty()) {
+            std::ifstream input(input_file, std::ios::in | std::ios::binary);
+            job.input.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        }
+        if (!tx::open_rom_file(rom).has_value()) {
+            auto& shared = assembled[rom];
+            if (shared == nullptr) shared = std::make_shared<const tx::SharedRom>(load_rom(rom, "Assembling"));
+            job.rom = shared;
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    std::ofstream dest;
+    if (!destName.empty()) dest.open(destName, std::ios::out);
+    std::ostream& out = destName.empty() ? std::cout : dest;
+
+    auto begin = std::chrono::steady_clock::now();
+    tx::batch::run(
+        jobs,
+        [&](const tx::batch::Result& result) { out << tx::batch::to_json(jobs[result.job], result) << '\n'; },
+        threads
+    );
+    out.flush();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    log_cli("Ran {} jobs in {:.3f}s\n", jobs.size(), seconds);
 }
 
 void cmd_build(const std::string& srcName, const std::string& destName) {
@@ -56,6 +285,17 @@ void cmd_build(const std::string& srcName, const std::string& destName) {
     log_cli("Wrote {} bytes tx8 binary to {}\n", header.size() + info.size, destName);
 }
 
+void cmd_aot(const std::string& fname, const std::string& destName) {
+    tx::Rom rom = load_rom(fname, "Translating");
+
+    tx::aot::Translator translator(rom);
+    std::string         source = translator.translate(fname);
+
+    std::ofstream dest(destName, std::ios::out);
+    dest << source;
+    log_cli("Wrote C++ translation to {}\n", destName);
+}
+
 int main() {
     CLI::App app {"tx8 CLI"};
 
@@ -69,17 +309,60 @@ int main() {
     app.parse_complete_callback([&]() {
         if (debug) tx::log_debug.init_stream(&std::cerr);
         if (!quiet) log_cli.init_stream(&std::cout);
+        // cli messages are rare and have to appear before the output of the rom they announce
+        log_cli.set_flush_threshold(0);
     });
 
     auto* run = app.add_subcommand("run", "Run a tx8 file");
 
     std::string run_src;
+    size_t      run_profile_fusions = 0;
+    bool        run_jit             = false;
+    bool        run_async_output    = false;
+    bool        run_stats           = false;
 
     run->add_option("file", run_src, "The tx8 file to run. Can be a source file or a binary file")
         ->required()
         ->check(CLI::ExistingFile);
+    run->add_option(
+        "--profile-fusions",
+        run_profile_fusions,
+        "Count executed opcode pairs and print up to this many candidates for new fusions"
+    );
 
-    run->callback([&]() { cmd_run(run_src); });
+    run->add_flag("--jit", run_jit, "Compile hot code to native code (x86-64 Linux only)");
+    run->add_flag("--async-output", run_async_output, "Write the output of the rom on a separate thread");
+    run->add_flag("--stats", run_stats, "Print execution counters, including how often modified code was discarded");
+
+    run->callback([&]() { cmd_run(run_src, run_profile_fusions, run_jit, run_async_output, run_stats); });
+
+    auto*       fuzz = app.add_subcommand("fuzz", "Run a tx8 file as a fork server for fuzzing its input");
+    std::string fuzz_src;
+    bool        fuzz_fork = false;
+    bool        fuzz_jit  = false;
+
+    fuzz->add_option("file", fuzz_src, "The tx8 file to fuzz. Can be a source file or a binary file")
+        ->required()
+        ->check(CLI::ExistingFile);
+    fuzz->add_flag("--fork", fuzz_fork, "Fork a process for every input instead of restoring a snapshot");
+    fuzz->add_flag("--jit", fuzz_jit, "Compile hot code to native code (x86-64 Linux only)");
+
+    fuzz->callback([&]() { cmd_fuzz(fuzz_src, fuzz_fork, fuzz_jit); });
+
+    auto* batch = app.add_subcommand("batch", "Run many tx8 files in parallel and print their results as JSON lines");
+    std::vector<std::string> batch_files;
+    std::string              batch_jobs;
+    size_t                   batch_threads = 0;
+    std::string              batch_dest;
+
+    batch->add_option("files", batch_files, "The tx8 files to run. Can be source files or binary files")
+        ->check(CLI::ExistingFile);
+    batch->add_option("--jobs", batch_jobs, "File listing one job per line: a tx8 file and optionally an input file")
+        ->check(CLI::ExistingFile);
+    batch->add_option("-j,--threads", batch_threads, "Number of threads (default: one per hardware thread)");
+    batch->add_option("-o,--output", batch_dest, "The file to write the results to (default: stdout)");
+
+    batch->callback([&]() { cmd_batch(batch_files, batch_jobs, batch_threads, batch_dest); });
 
     auto*       build = app.add_subcommand("build", "Build a tx8 rom from a source file");
     std::string build_src;
@@ -93,6 +376,17 @@ int main() {
 
     build->callback([&]() { cmd_build(build_src, build_dest); });
 
+    auto*       aot = app.add_subcommand("aot", "Translate a tx8 rom to a C++ source file ahead of time");
+    std::string aot_src;
+    std::string aot_dest = "out.cpp";
+
+    aot->add_option("file", aot_src, "The tx8 file to translate. Can be a source file or a binary file")
+        ->required()
+        ->check(CLI::ExistingFile);
+    aot->add_option("-o,--output", aot_dest, "The C++ file to write the translation to")->default_str("out.cpp");
+
+    aot->callback([&]() { cmd_aot(aot_src, aot_dest); });
+
     tx::log.init_stream(&std::cout);
     tx::log_err.init_stream(&std::cerr);
 
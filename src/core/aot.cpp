@@ -0,0 +1,294 @@
+#include "tx8/core/aot.hpp"
+
+#include "tx8/core/cpu.hpp"
+#include "tx8/core/instruction.hpp"
+#include "tx8/core/log.hpp"
+#include "tx8/core/types.hpp"
+
+#include <algorithm>
+#include <fmt/format.h>
+
+namespace tx::aot {
+    /// Check if a parameter is a constant
+    static inline bool is_constant(const Parameter& param) {
+        return param.mode >= ParamMode::Constant8 && param.mode <= ParamMode::Constant32;
+    }
+
+    /// Get the C++ expression of a full size register parameter other than p (empty if there is none)
+    static std::string register_expr(const Parameter& param) {
+        if (param.mode != ParamMode::Register || (param.value.u & REG_SIZE_MASK) != REG_SIZE_4) return "";
+        uint32 id = param.value.u & REG_ID_MASK;
+        if (id >= REGISTER_COUNT || id == (uint32) Register::P) return "";
+        return fmt::format("cpu.{}", reg_names[id]);
+    }
+
+    /// Get the C++ expression of the value of a source parameter of the instruction at `addr` (empty if it cannot be
+    /// translated)
+    static std::string source_expr(const Parameter& param, mem_addr addr, bool sign_extended) {
+        switch (param.mode) {
+            case ParamMode::Constant8:
+                return fmt::format("{:#x}U", sign_extended ? (uint32) (int32) (int8) param.value.u : param.value.u);
+            case ParamMode::Constant16:
+                return fmt::format("{:#x}U", sign_extended ? (uint32) (int32) (int16) param.value.u : param.value.u);
+            case ParamMode::Constant32: return fmt::format("{:#x}U", param.value.u);
+            case ParamMode::Register:
+                if (param.value.u == (uint32) Register::P) return fmt::format("{:#x}U", addr);
+                return register_expr(param);
+            case ParamMode::AbsoluteAddress: return fmt::format("rt.read({:#x}U)", param.value.u);
+            case ParamMode::RelativeAddress: return fmt::format("rt.read(cpu.o + {:#x}U)", param.value.u);
+            case ParamMode::RegisterAddress:
+                if (param.value.u == (uint32) Register::P) return fmt::format("rt.read({:#x}U)", addr);
+                if (register_expr(param).empty()) return "";
+                return fmt::format("rt.read({})", register_expr(param));
+            default: return "";
+        }
+    }
+
+    /// Translate an instruction to a native C++ statement (empty if it has to be executed by its handler)
+    static std::string native_stmt(const Instruction& inst, mem_addr addr) {
+        const auto& [p1, p2] = inst.params;
+        Opcode op            = inst.opcode;
+
+        std::string      dst = register_expr(p1);
+        const Parameter* src = &p2;
+        switch (op) {
+            case Opcode::Lda:
+            case Opcode::Ldb:
+            case Opcode::Ldc:
+            case Opcode::Ldd:
+                dst = fmt::format("cpu.{}", reg_names[((uint32) op - (uint32) Opcode::Lda) / 2]);
+                src = &p1;
+                op  = Opcode::Ld;
+                break;
+            case Opcode::Zero: return dst.empty() ? "" : fmt::format("{} = 0;", dst);
+            case Opcode::Inc: return dst.empty() ? "" : fmt::format("rt.add({}, 1, cpu.r);", dst);
+            case Opcode::Dec: return dst.empty() ? "" : fmt::format("rt.sub({}, 1, cpu.r);", dst);
+            case Opcode::Ld:
+            case Opcode::Lds:
+            case Opcode::Add:
+            case Opcode::Sub:
+            case Opcode::Uadd:
+            case Opcode::Usub:
+            case Opcode::And:
+            case Opcode::Or:
+            case Opcode::Xor:
+            case Opcode::Cmp:
+            case Opcode::Ucmp: break;
+            default: return "";
+        }
+        if (dst.empty()) return "";
+
+        bool        is_signed = op == Opcode::Add || op == Opcode::Sub || op == Opcode::Cmp || op == Opcode::Lds;
+        std::string value     = source_expr(*src, addr, is_signed);
+        if (value.empty()) return "";
+
+        switch (op) {
+            case Opcode::Ld:
+            case Opcode::Lds: return fmt::format("{} = {};", dst, value);
+            case Opcode::Add:
+            case Opcode::Uadd: return fmt::format("rt.add({}, {}, cpu.r);", dst, value);
+            case Opcode::Sub:
+            case Opcode::Usub: return fmt::format("rt.sub({}, {}, cpu.r);", dst, value);
+            case Opcode::And: return fmt::format("{} &= {};", dst, value);
+            case Opcode::Or: return fmt::format("{} |= {};", dst, value);
+            case Opcode::Xor: return fmt::format("{} ^= {};", dst, value);
+            case Opcode::Cmp: return fmt::format("cpu.r = rt.cmp({}, {});", dst, value);
+            default: return fmt::format("cpu.r = rt.ucmp({}, {});", dst, value);
+        }
+    }
+
+    Translator::Translator(const Rom& rom) : rom(rom), cpu(rom) {}
+
+    bool Translator::in_rom(mem_addr addr) const { return addr >= ROM_START && addr - ROM_START < rom.size(); }
+
+    std::vector<mem_addr> Translator::recover() {
+        std::vector<bool>     visited(rom.size());
+        std::vector<mem_addr> pending = {ENTRY_POINT};
+        std::vector<mem_addr> code;
+
+        while (!pending.empty()) {
+            mem_addr addr = pending.back();
+            pending.pop_back();
+            if (!in_rom(addr) || visited[addr - ROM_START]) continue;
+            visited[addr - ROM_START] = true;
+
+            Instruction inst = cpu.parse_instruction(addr);
+            mem_addr    next = addr + inst.len;
+            // invalid instructions and instructions reaching past the end of the rom are left to the interpreter
+            if (CPU::op_handlers[(uint32) inst.opcode] == &CPU::op_inv || !in_rom(next - 1)) continue;
+            code.push_back(addr);
+
+            const Parameter& p1 = inst.params.p1;
+            switch (inst.opcode) {
+                case Opcode::Hlt:
+                case Opcode::Ret:
+                case Opcode::Stop: break;
+                case Opcode::Jmp:
+                    // a jump to itself continues with the next instruction
+                    if (is_constant(p1)) pending.push_back(p1.value.u == addr ? next : p1.value.u);
+                    break;
+                case Opcode::Jeq:
+                case Opcode::Jne:
+                case Opcode::Jgt:
+                case Opcode::Jge:
+                case Opcode::Jlt:
+                case Opcode::Jle:
+                case Opcode::Call:
+                    if (is_constant(p1)) pending.push_back(p1.value.u);
+                    pending.push_back(next);
+                    break;
+                default: pending.push_back(next); break;
+            }
+        }
+
+        std::sort(code.begin(), code.end());
+        return code;
+    }
+
+    std::string Translator::translate_instruction(size_t index, const std::vector<mem_addr>& code) {
+        mem_addr         addr = code[index];
+        Instruction      inst = cpu.parse_instruction(addr);
+        mem_addr         next = addr + inst.len;
+        const Parameter& p1   = inst.params.p1;
+
+        // statement continuing execution at the given address
+        auto go = [&](mem_addr target) {
+            if (std::binary_search(code.begin(), code.end(), target)) return fmt::format("goto L_{:x};", target);
+            return fmt::format("{{ cpu.p = {:#x}; continue; }}", target);
+        };
+
+        std::string out           = fmt::format("    L_{:x}: // {}\n", addr, inst);
+        bool        falls_through = true;
+        if (inst.opcode >= Opcode::Jmp && inst.opcode <= Opcode::Jle && is_constant(p1)) {
+            static const std::array<std::string, 6> conditions = {"==", "!=", ">", ">=", "<", "<="};
+
+            // a jump to itself continues with the next instruction
+            if (p1.value.u != addr) {
+                if (inst.opcode == Opcode::Jmp) {
+                    out += fmt::format("        {}\n", go(p1.value.u));
+                    falls_through = false;
+                } else {
+                    const std::string& condition = conditions[(uint32) inst.opcode - (uint32) Opcode::Jeq];
+                    out += fmt::format("        if ((tx::int32) cpu.r {} 0) {}\n", condition, go(p1.value.u));
+                }
+            }
+        } else {
+            std::string stmt = native_stmt(inst, addr);
+            if (stmt.empty()) stmt = fmt::format("if (rt.exec({})) continue;", index);
+            out += fmt::format("        {}\n", stmt);
+        }
+
+        if (falls_through && (index + 1 == code.size() || code[index + 1] != next))
+            out += fmt::format("        {}\n", go(next));
+        return out;
+    }
+
+    std::string Translator::translate(const std::string& source) {
+        std::vector<mem_addr> code = recover();
+
+        std::string out = fmt::format(
+            "// tx8 rom {} translated to C++ by tx8-cli aot\n\n"
+            "#include \"tx8/core/aot.hpp\"\n"
+            "#include \"tx8/core/cpu.hpp\"\n"
+            "#include \"tx8/core/log.hpp\"\n"
+            "#include \"tx8/core/stdlib.hpp\"\n\n"
+            "#include <iostream>\n\n",
+            source
+        );
+
+        // arrays must not be empty, so both get a trailing dummy element
+        out += "namespace {\n    // clang-format off\n";
+        out += fmt::format("    const size_t rom_size = {};\n    const tx::uint8 rom[] = {{", rom.size());
+        for (size_t i = 0; i < rom.size(); ++i) out += fmt::format("{}{:#04x},", i % 16 == 0 ? "\n        " : " ", rom[i]);
+        out += "\n        0\n    };\n";
+        out += fmt::format("    const size_t code_size = {};\n    const tx::mem_addr code[] = {{", code.size());
+        for (size_t i = 0; i < code.size(); ++i) out += fmt::format("{}{:#x},", i % 8 == 0 ? "\n        " : " ", code[i]);
+        out += "\n        0\n    };\n    // clang-format on\n} // namespace\n\n";
+
+        out += "tx::Rom tx8_aot_rom() { return {rom, rom + rom_size}; }\n\n";
+        out += "void tx8_aot_run(tx::CPU& cpu) {\n";
+        out += "    tx::aot::Runtime rt(cpu, rom, rom_size, code, code_size);\n";
+        out += "    for (;;) {\n";
+        out += "        if (!rt.running()) return;\n";
+        out += "        switch (cpu.p) {\n";
+        for (mem_addr addr : code) out += fmt::format("            case {:#x}: goto L_{:x};\n", addr, addr);
+        out += "            default: rt.step(); continue;\n";
+        out += "        }\n\n";
+        for (size_t i = 0; i < code.size(); ++i) out += translate_instruction(i, code);
+        out += "    }\n}\n\n";
+
+        out += "#ifndef TX8_AOT_NO_MAIN\n"
+               "int main() {\n"
+               "    tx::log.init_stream(&std::cout);\n"
+               "    tx::log_err.init_stream(&std::cerr);\n\n"
+               "    tx::CPU cpu(tx8_aot_rom());\n"
+               "    tx::stdlib::use_stdlib(cpu);\n"
+               "    tx8_aot_run(cpu);\n"
+               "    return 0;\n"
+               "}\n"
+               "#endif\n";
+        return out;
+    }
+
+    Runtime::Runtime(CPU& cpu, const uint8* rom, size_t rom_size, const mem_addr* code, size_t code_size)
+        : cpu(cpu) {
+        // translated code does not log the instructions it executes, so debug logging needs the interpreter
+        matches = !cpu.sinks.debug->is_enabled() && rom_size <= ROM_SIZE
+               && memcmp(cpu.mem.data() + ROM_START, rom, rom_size) == 0;
+        if (!matches) return;
+
+        this->code.reserve(code_size);
+        for (size_t i = 0; i < code_size; ++i) {
+            const DecodedInstruction& slot = cpu.decode_slot(code[i]);
+            this->code.push_back({code[i], slot.inst, slot.handler});
+        }
+        code_version = cpu.code_version;
+    }
+
+    bool Runtime::running() {
+        if (cpu.halted) {
+            cpu.flush_sinks();
+            return false;
+        }
+        if (matches && cpu.code_version == code_version && !cpu.stopped && cpu.next_event == CPU::NO_EVENT
+            && cpu.p <= MEM_SIZE - INSTRUCTION_MAX_LENGTH - 1)
+            return true;
+
+        // the interpreter takes care of stopping, interrupts (translated code does not count cycles), invalid program
+        // counters and modified code
+        matches = false;
+        cpu.run();
+        return false;
+    }
+
+    void Runtime::step() {
+        const DecodedInstruction& decoded = cpu.decode(cpu.p);
+        cpu.current                       = &decoded;
+
+        mem_addr prev_p  = cpu.p;
+        uint8    advance = decoded.advance;
+        ++cpu.stats.dispatches;
+        (cpu.*decoded.entry)(decoded.inst.params);
+        cpu.materialize_r();
+        if (cpu.p == prev_p) cpu.p += advance;
+    }
+
+    bool Runtime::exec(size_t index) {
+        const Call& call = code[index];
+
+        cpu.p = call.addr;
+        (cpu.*call.handler)(call.inst.params);
+        // translated code accesses R directly
+        cpu.materialize_r();
+
+        // an interrupt may become due (e. g. after `ei` or `set_timer`), which only the interpreter handles
+        bool jumped = cpu.p != call.addr;
+        if (!jumped && !cpu.halted && !cpu.stopped && cpu.code_version == code_version
+            && cpu.next_event == CPU::NO_EVENT)
+            return false;
+
+        // leave the instruction sequence like the run loop would continue
+        if (!jumped) cpu.p += call.inst.len;
+        return true;
+    }
+} // namespace tx::aot
@@ -0,0 +1,140 @@
+#include "tx8/core/batch.hpp"
+
+#include "tx8/core/cpu.hpp"
+#include "tx8/core/log.hpp"
+#include "tx8/core/stdlib.hpp"
+#include "tx8/core/util.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fmt/format.h>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace tx::batch {
+    /// Jobs assigned to one thread; the owner takes them from the front, other threads steal from the back
+    struct Queue {
+        std::mutex         mutex;
+        std::deque<size_t> jobs;
+    };
+
+    /// Take the next job of the given thread, stealing one if its own queue is empty (nullopt if all jobs are taken)
+    static std::optional<size_t> take(std::vector<Queue>& queues, size_t self) {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            Queue&                      queue = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty()) continue;
+
+            size_t job;
+            if (i == 0) {
+                job = queue.jobs.front();
+                queue.jobs.pop_front();
+            } else {
+                job = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+            return job;
+        }
+        return std::nullopt;
+    }
+
+    /// Run a single job, capturing its output (`file` is the opened rom file of jobs without a loaded rom)
+    static Result run_job(const Job& job, const std::optional<RomFile>& file, size_t index) {
+        auto begin = std::chrono::steady_clock::now();
+        Log  out;
+        Log  err;
+        // debug output of parallel jobs is discarded, the global debug logger must not be shared between threads
+        Log debug;
+        out.init_str();
+        err.init_str();
+        CpuSinks sinks;
+        sinks.out   = &out;
+        sinks.err   = &err;
+        sinks.debug = &debug;
+
+        Result                   result {index, false, 0, 0, 0, 0, "", ""};
+        std::unique_ptr<tx::CPU> cpu;
+        if (job.rom != nullptr) cpu = std::make_unique<tx::CPU>(*job.rom, sinks);
+        else if (file.has_value()) cpu = std::make_unique<tx::CPU>(file.value(), sinks);
+        else err("Could not load rom file {}\n", job.path);
+
+        if (cpu != nullptr) {
+            stdlib::use_stdlib(*cpu);
+            size_t consumed = 0;
+            cpu->replace_sysfunc("get", [&](tx::CPU& cpu) {
+                char c = consumed < job.input.size() ? job.input[consumed++] : (char) EOF;
+                cpu.push(c, ValueSize::Byte);
+            });
+            cpu->run();
+
+            result.a            = cpu->a;
+            result.p            = cpu->p;
+            result.instructions = cpu->stats.instructions();
+        }
+
+        result.output  = out.get_str();
+        result.errors  = err.get_str();
+        result.error   = !result.errors.empty();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        return result;
+    }
+
+    void run(const std::vector<Job>& jobs, const ResultHandler& on_result, size_t threads) {
+        if (threads == 0) threads = MAX(std::thread::hardware_concurrency(), 1u);
+        threads = MIN(threads, MAX(jobs.size(), (size_t) 1));
+
+        // the global loggers are not thread safe, so rom files (whose header parsing may log) are opened up front
+        std::vector<std::optional<RomFile>> files(jobs.size());
+        for (size_t i = 0; i < jobs.size(); ++i)
+            if (jobs[i].rom == nullptr) files[i] = open_rom_file(jobs[i].path);
+
+        std::vector<Queue> queues(threads);
+        for (size_t i = 0; i < jobs.size(); ++i) queues[i % threads].jobs.push_back(i);
+
+        std::mutex               results_mutex;
+        std::vector<std::thread> workers;
+        for (size_t self = 0; self < threads; ++self) {
+            workers.emplace_back([&, self]() {
+                while (auto index = take(queues, self)) {
+                    Result result = run_job(jobs[index.value()], files[index.value()], index.value());
+
+                    std::lock_guard<std::mutex> lock(results_mutex);
+                    on_result(result);
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+    }
+
+    /// Format a string as a JSON string literal (bytes outside of ASCII are escaped as the code points 0x80 - 0xff)
+    static std::string json_string(const std::string& s) {
+        std::string out = "\"";
+        for (char c : s) {
+            auto byte = (uint8) c;
+            if (c == '"') out += "\\\"";
+            else if (c == '\\') out += "\\\\";
+            else if (c == '\n') out += "\\n";
+            else if (byte < 0x20 || byte >= 0x7f) out += fmt::format("\\u{:04x}", byte);
+            else out += c;
+        }
+        return out + "\"";
+    }
+
+    std::string to_json(const Job& job, const Result& result) {
+        return fmt::format(
+            R"({{"job":{},"path":{},"status":"{}","a":{},"p":{},"instructions":{},"seconds":{:.6f},"output":{},)"
+            R"("errors":{}}})",
+            result.job,
+            json_string(job.path),
+            result.error ? "error" : "halted",
+            result.a,
+            result.p,
+            result.instructions,
+            result.seconds,
+            json_string(result.output),
+            json_string(result.errors)
+        );
+    }
+} // namespace tx::batch
@@ -1,13 +1,23 @@
 #include "tx8/core/cpu.hpp"
 
 #include "tx8/core/instruction.hpp"
+#include "tx8/core/jit.hpp"
 #include "tx8/core/log.hpp"
 #include "tx8/core/types.hpp"
 #include "tx8/core/util.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cmath>
+#include <type_traits>
 #include <utility>
 
+#if (defined(__SSE__) || defined(_M_X64)) && !defined(TX8_NO_SIMD)
+/// Defined if the vector instructions use SSE
+#define TX8_VECTOR_SSE
+#include <xmmintrin.h>
+#endif
+
 #pragma clang diagnostic ignored "-Wunused-parameter"
 
 #define ERR_ROM_TOO_LARGE "Could not initialize CPU: rom is too large"
@@ -23,15 +33,46 @@
 #define ERR_INVALID_REG_SIZE  "Exception: Invalid register size {:#x}"
 #define ERR_CANNOT_LOAD_WORD  "Exception: Cannot load a word into a smaller register"
 #define ERR_DIV_BY_ZERO       "Exception: Division by zero"
+#define ERR_INVALID_INTERRUPT "Exception: Invalid interrupt {}"
+#define ERR_DEVICE_RANGE \
+    "Could not map device to {} bytes at #{:x}; The range has to cover whole pages of memory not mapped to " \
+    "another device"
 
 namespace tx {
-    CPU::CPU(Rom rom) { // NOLINT
-        if (rom.size() > ROM_SIZE) {
-            error(ERR_ROM_TOO_LARGE);
-            return;
-        }
+    /// The opcode sequences every cpu fuses by default
+    static std::vector<Fusion> builtin_fusions() {
+        std::vector<Fusion> fusions;
+
+        // instructions setting R followed by a conditional jump reading it
+        for (Opcode first :
+             {Opcode::Cmp, Opcode::Ucmp, Opcode::Fcmp, Opcode::Test, Opcode::Inc, Opcode::Dec, Opcode::Add, Opcode::Sub})
+            for (auto jump = (uint32) Opcode::Jeq; jump <= (uint32) Opcode::Jle; ++jump)
+                fusions.push_back({{first, (Opcode) jump}, 2});
+
+        // calling convention sequences
+        fusions.push_back({{Opcode::Push, Opcode::Push, Opcode::Call}, 3});
+        fusions.push_back({{Opcode::Push, Opcode::Call}, 2});
+        fusions.push_back({{Opcode::Push, Opcode::Sys}, 2});
+        fusions.push_back({{Opcode::Pop, Opcode::Ret}, 2});
+        fusions.push_back({{Opcode::Pop, Opcode::Pop}, 2});
+
+        return fusions;
+    }
+
+#ifdef TX8_DISPATCH_FUNCTION
+    /// Wrap every opcode handler into a `std::function` for the reference dispatch engine
+    static auto make_function_table(const std::array<OpHandler, 256>& handlers) {
+        std::array<std::function<void(CPU*, const Parameters& params)>, 256> table;
+        for (size_t i = 0; i < handlers.size(); ++i) table[i] = handlers[i];
+        return table;
+    }
 
-        // initialize registers and memory
+    CPU::CPU(Memory memory, const CpuSinks& sinks)
+        : mem(std::move(memory)), sinks(sinks), op_function(make_function_table(op_handlers)) { // NOLINT
+#else
+    CPU::CPU(Memory memory, const CpuSinks& sinks) : mem(std::move(memory)), sinks(sinks) { // NOLINT
+#endif
+        // initialize registers
         halted  = false;
         stopped = false;
         rseed   = RAND_INITIAL_SEED;
@@ -43,39 +84,113 @@ namespace tx {
         r       = 0;
         s       = STACK_BEGIN;
         p       = ENTRY_POINT;
-        mem     = std::vector<uint8>(MEM_SIZE);
+
+        decode_cache = std::vector<std::unique_ptr<DecodePage>>(DECODE_PAGE_COUNT);
+        page_table   = std::vector<uint8*>(BUS_PAGE_COUNT, mem.data());
+        fusions      = builtin_fusions();
+    }
+
+    CPU::CPU(std::span<const uint8> rom, const CpuSinks& sinks) : CPU(Memory(MEM_SIZE + MEM_GUARD_SIZE), sinks) {
+        if (rom.size() > ROM_SIZE) {
+            error(ERR_ROM_TOO_LARGE);
+            return;
+        }
 
         // load rom into memory
+        mem.use_huge_pages(ROM_START, rom.size());
         std::copy(rom.begin(), rom.end(), mem.begin() + ROM_START);
     }
 
+    CPU::CPU(const RomFile& file, const CpuSinks& sinks)
+        : CPU(Memory(MEM_SIZE + MEM_GUARD_SIZE, ROM_START, file.path, file.offset, MIN(file.info.size, ROM_SIZE)),
+              sinks) {
+        if (file.info.size > ROM_SIZE) error(ERR_ROM_TOO_LARGE);
+    }
+
+    CPU::CPU(const SharedRom& rom, const CpuSinks& sinks)
+        : CPU(Memory(MEM_SIZE + MEM_GUARD_SIZE, ROM_START, rom), sinks) {
+        if (rom.size() > ROM_SIZE) error(ERR_ROM_TOO_LARGE);
+    }
+
+    CPU::~CPU() = default;
+
     void CPU::run() {
-        log_debug("[cpu] Beginning execution...\n");
+        Log& debug = *sinks.debug;
+        debug("[cpu] Beginning execution...\n");
+        // the memory may have been modified since the last run
+        idle_armed = false;
 
         tx::uint32 prev_p;
+#ifdef TX8_JIT_SUPPORTED
+        // if p was reached by a jump, so it may be the start of a compiled block
+        bool block_entry = true;
+#endif
         while (!halted) {
             if (p > MEM_SIZE - INSTRUCTION_MAX_LENGTH - 1 || p < 0) {
                 error(ERR_INVALID_PC);
                 break;
             }
 
-            // TODO: implement properly upon implementing interrupts
-            if (stopped) {
-                halted = true;
-                log_debug("[cpu] Stopped.\n");
-                break;
+            if (stopped) [[unlikely]] {
+                if (!wait_for_interrupt()) {
+                    halted = true;
+                    debug("[cpu] Stopped.\n");
+                    break;
+                }
+                // the handler of the interrupt may have been called
+                continue;
             }
 
-            Instruction current_instruction = parse_instruction(p);
+#ifdef TX8_JIT_SUPPORTED
+            if (jit != nullptr && block_entry) {
+                mem_addr entered = p;
+                block_entry      = jit->enter();
+                if (block_entry) {
+                    poll_interrupts(entered);
+                    continue;
+                }
+            }
+#endif
+
+            const DecodedInstruction& decoded             = decode(p);
+            const Instruction&        current_instruction = decoded.inst;
+            current                                       = &decoded;
+
+            if (fusion_profile != nullptr) [[unlikely]] {
+                if (fusion_profile->next == p)
+                    ++fusion_profile->counts[((uint32) fusion_profile->last << 8U) | (uint32) current_instruction.opcode];
+                fusion_profile->next = p + current_instruction.len;
+                fusion_profile->last = current_instruction.opcode;
+            }
 
-            if (current_instruction.opcode != Opcode::Nop) { log_debug("[cpu] [#{:x}] {}\n", p, current_instruction); }
+            if (current_instruction.opcode != Opcode::Nop) { debug("[cpu] [#{:x}] {}\n", p, current_instruction); }
             prev_p = p;
+            ++stats.dispatches;
+            // read before executing, as the instruction might overwrite its own cache slot
+            uint8 advance = decoded.advance;
+            uint8 length  = decoded.length;
+#ifdef TX8_DISPATCH_FUNCTION
             exec_instruction(current_instruction);
-
-            // do not increment p if instruction changes p
-            if (p == prev_p) p += current_instruction.len;
+#else
+            (this->*decoded.entry)(current_instruction.params);
+#endif
+
+            // do not increment p if instruction changes p (fused handlers always set p themselves, an unchanged p means
+            // they jumped back to their start)
+            if (p == prev_p && advance != 0) p += advance;
+            // fused instructions that did not jump continue sequentially as well (a fused jump to the address behind
+            // them looks the same, which only delays the next poll)
+            else if (advance != 0 || p != prev_p + length) {
+#ifdef TX8_JIT_SUPPORTED
+                block_entry = true;
+#endif
+                // interrupts are only handled at block boundaries, so straight-line code does not pay for them
+                poll_interrupts(prev_p);
+            }
         }
-        log_debug("[cpu] Halted.\n");
+        materialize_r();
+        debug("[cpu] Halted.\n");
+        flush_sinks();
     }
 
     uint32 CPU::rand() {
@@ -91,16 +206,25 @@ namespace tx {
             return nop;
         }
 
-        mem_ptr p      = mem.data() + pc;
-        uint8   pcount = param_count[p[0]];
+        // instructions touching a device page are fetched through the memory bus
+        std::array<uint8, INSTRUCTION_MAX_LENGTH> fetched;
+        const uint8*                              p = page_table[pc >> BUS_PAGE_BITS];
+        if (p != nullptr) p += pc;
+        else {
+            for (uint32 i = 0; i < fetched.size(); ++i) fetched[i] = bus_read(pc + i, ValueSize::Byte);
+            p = fetched.data();
+        }
+        uint8 pcount = param_count[p[0]];
 
         uint8 mode_p1 = pcount > 0 ? p[1] >> 4U : 0;
         uint8 mode_p2 = pcount > 1 ? p[1] & PARAM_MODE_2_MASK : 0;
 
-        mem_addr param_start = pc + 1 + param_mode_bytes[pcount];
-
-        uint32 value_p1 = mem_read(param_start) & param_masks[mode_p1];
-        uint32 value_p2 = mem_read(param_start + param_sizes[mode_p1]) & param_masks[mode_p2];
+        uint32 param_start = 1 + param_mode_bytes[pcount];
+        uint32 value_p1, value_p2;
+        memcpy(&value_p1, p + param_start, sizeof(value_p1));
+        memcpy(&value_p2, p + param_start + param_sizes[mode_p1], sizeof(value_p2));
+        value_p1 &= param_masks[mode_p1];
+        value_p2 &= param_masks[mode_p2];
 
         // clang-format off
         Instruction inst = {
@@ -122,26 +246,474 @@ namespace tx {
         return inst;
     }
 
+    const DecodedInstruction& CPU::decode(mem_addr pc) {
+        const auto& page = decode_cache[pc >> DECODE_PAGE_BITS];
+        if (page != nullptr) {
+            const DecodedInstruction& slot = (*page)[pc & (DECODE_PAGE_SIZE - 1)];
+            if (slot.entry != nullptr) return slot;
+        }
+
+        DecodedInstruction& slot = decode_slot(pc);
+        fuse(pc, slot);
+        return slot;
+    }
+
+    DecodedInstruction& CPU::decode_slot(mem_addr pc) {
+        auto& page = decode_cache[pc >> DECODE_PAGE_BITS];
+        if (page == nullptr) page = std::make_unique<DecodePage>();
+
+        DecodedInstruction& slot = (*page)[pc & (DECODE_PAGE_SIZE - 1)];
+        if (slot.inst.len == 0) {
+            slot.inst    = parse_instruction(pc);
+            slot.handler = select_handler(slot.inst);
+            slot.entry   = nullptr;
+            slot.next    = nullptr;
+            slot.advance = slot.inst.len;
+            slot.length  = slot.inst.len;
+            mark_code(pc, pc + slot.inst.len - 1);
+            if (slot.inst.opcode == Opcode::Sys) resolve_sysfunc(slot);
+        }
+        return slot;
+    }
+
+    void CPU::fuse(mem_addr pc, DecodedInstruction& slot) {
+        slot.entry   = slot.handler;
+        slot.advance = slot.inst.len;
+        slot.length  = slot.inst.len;
+
+#ifndef TX8_DISPATCH_FUNCTION
+        if (fusion_profile != nullptr) return;
+
+        // `slot` and the instructions following it, parsed on demand without caching them, as they may never execute;
+        // only plain memory is read (the page before a device is not direct, so instructions never reach into one)
+        std::array<Instruction, FUSION_MAX_LENGTH> insts  = {slot.inst};
+        uint32                                     parsed = 1;
+        mem_addr                                   next   = pc + slot.inst.len;
+
+        uint32 best = 1;
+        for (const auto& fusion : fusions) {
+            if (fusion.length <= best || fusion.ops[0] != slot.inst.opcode) continue;
+
+            while (parsed < fusion.length && next <= MEM_SIZE - INSTRUCTION_MAX_LENGTH - 1
+                   && page_table[next >> BUS_PAGE_BITS] != nullptr) {
+                insts[parsed] = parse_instruction(next);
+                next += insts[parsed++].len;
+            }
+            if (parsed < fusion.length) continue;
+
+            bool matches = true;
+            for (uint32 i = 1; i < fusion.length; ++i) matches = matches && insts[i].opcode == fusion.ops[i];
+            if (matches) best = fusion.length;
+        }
+        if (best == 1) return;
+
+        // only the fused instructions become cached (and tracked) code
+        std::array<DecodedInstruction*, FUSION_MAX_LENGTH> slots = {&slot};
+        for (uint32 i = 1; i < best; ++i) {
+            slots[i] = &decode_slot(pc + slot.length);
+            slot.length += slots[i]->inst.len;
+        }
+
+        for (uint32 i = 0; i + 1 < best; ++i) slots[i]->next = slots[i + 1];
+        slot.advance = 0;
+        slot.entry   = best == 3 ? &CPU::op_fused<3> : select_fused_jump(slot.handler, *slots[1]);
+#endif
+    }
+
+    template <uint32 count>
+    void CPU::op_fused(const Parameters& params) {
+        const DecodedInstruction* head = current;
+        const DecodedInstruction* slot = head;
+        mem_addr                  addr = p;
+        for (uint32 i = 0; i < count; ++i) {
+            if (i > 0) {
+                // stop wherever the run loop would not simply continue with the next instruction, including when the
+                // fused instructions were overwritten
+                if (halted || stopped || head->inst.len == 0) return;
+                slot = slot->next;
+                ++stats.fused;
+                if (slot->inst.opcode != Opcode::Nop) { (*sinks.debug)("[cpu] [#{:x}] {}\n", addr, slot->inst); }
+            }
+
+            uint8 len = slot->inst.len;
+            (this->*slot->handler)(i == 0 ? params : slot->inst.params);
+
+            if (p != addr) return;
+            p = addr += len;
+        }
+    }
+
+    void CPU::raise_interrupt(uint32 interrupt) {
+        if (interrupt >= INTERRUPT_COUNT) {
+            error(ERR_INVALID_INTERRUPT, interrupt);
+            return;
+        }
+        pending_interrupts |= 1U << interrupt;
+        stopped = false;
+        update_next_event();
+    }
+
+    void CPU::schedule_interrupt(uint32 interrupt, uint64 delay, uint64 period) {
+        if (interrupt >= INTERRUPT_COUNT) {
+            error(ERR_INVALID_INTERRUPT, interrupt);
+            return;
+        }
+        scheduled.push_back({stats.cycles() + delay, period, schedule_count++, interrupt});
+        std::push_heap(scheduled.begin(), scheduled.end(), std::greater<>());
+        update_next_event();
+    }
+
+    void CPU::cancel_interrupt(uint32 interrupt) {
+        std::erase_if(scheduled, [&](const ScheduledInterrupt& event) { return event.interrupt == interrupt; });
+        std::make_heap(scheduled.begin(), scheduled.end(), std::greater<>());
+        update_next_event();
+    }
+
+    void CPU::handle_interrupts() {
+        uint64 now = stats.cycles();
+        while (!scheduled.empty() && scheduled.front().cycle <= now) {
+            std::pop_heap(scheduled.begin(), scheduled.end(), std::greater<>());
+            ScheduledInterrupt& event = scheduled.back();
+            pending_interrupts |= 1U << event.interrupt;
+            if (event.period == 0) {
+                scheduled.pop_back();
+                continue;
+            }
+            event.cycle += event.period;
+            event.order = schedule_count++;
+            std::push_heap(scheduled.begin(), scheduled.end(), std::greater<>());
+        }
+        // a raised interrupt ends a stop, even if its handler is not called
+        if (pending_interrupts != 0) stopped = false;
+
+        if (interrupts_enabled && pending_interrupts != 0) {
+            uint32 interrupt = std::countr_zero(pending_interrupts);
+            pending_interrupts &= pending_interrupts - 1;
+
+            // interrupts without a handler are discarded; handlers run with interrupts disabled, like after `di`
+            mem_addr handler = mem_read(IVT_START + interrupt * 4);
+            if (handler != 0) {
+                (*sinks.debug)("[cpu] Interrupt {}, calling #{:x}\n", interrupt, handler);
+                interrupts_enabled = false;
+                idle_armed         = false;
+                ++stats.interrupts;
+                push(p);
+                jump(handler);
+            }
+        }
+        update_next_event();
+    }
+
+    bool CPU::wait_for_interrupt() {
+        if (pending_interrupts == 0) {
+            if (scheduled.empty()) return false;
+
+            // nothing happens until the next scheduled interrupt
+            uint64 now = stats.cycles();
+            if (scheduled.front().cycle > now) stats.idle += scheduled.front().cycle - now;
+        }
+        handle_interrupts();
+        return true;
+    }
+
+    /// Check if an instruction modifies nothing but registers, so a loop made of such instructions and polling unchanged
+    /// memory can only be left after an interrupt
+    static bool idle_safe(const Instruction& inst) {
+        switch (inst.opcode) {
+            case Opcode::Nop:
+            case Opcode::Jmp:
+            case Opcode::Jeq:
+            case Opcode::Jne:
+            case Opcode::Jgt:
+            case Opcode::Jge:
+            case Opcode::Jlt:
+            case Opcode::Jle:
+            case Opcode::Cmp:
+            case Opcode::Fcmp:
+            case Opcode::Ucmp:
+            case Opcode::Test:
+            case Opcode::Lda:
+            case Opcode::Ldb:
+            case Opcode::Ldc:
+            case Opcode::Ldd: return true;
+            default: break;
+        }
+
+        // instructions writing their first parameter are safe if it is a register
+        auto op           = (uint32) inst.opcode;
+        bool writes_first = (op >= (uint32) Opcode::Ld && op <= (uint32) Opcode::Lws) || op == (uint32) Opcode::Zero
+                         || (op >= (uint32) Opcode::Inc && op <= (uint32) Opcode::Sign)
+                         || (op >= (uint32) Opcode::And && op <= (uint32) Opcode::Tgl)
+                         || (op >= (uint32) Opcode::Finc && op <= (uint32) Opcode::Log10)
+                         || (op >= (uint32) Opcode::Uadd && op <= (uint32) Opcode::Umin)
+                         || (op >= (uint32) Opcode::Itf && op <= (uint32) Opcode::Ftu);
+        return writes_first && param_is_register(inst.params.p1.mode);
+    }
+
+    CPU::IdleLoop CPU::examine_loop(mem_addr start) {
+        IdleLoop loop = {start, start, code_version, false};
+        for (mem_addr addr = start;
+             addr - start < IDLE_LOOP_MAX_LENGTH && addr <= MEM_SIZE - INSTRUCTION_MAX_LENGTH - 1;) {
+            Instruction inst = parse_instruction(addr);
+            if (!idle_safe(inst)) break;
+            // reading a device may give a different value every time
+            if (!devices.empty()
+                && (param_is_address(inst.params.p1.mode) || param_is_address(inst.params.p2.mode)))
+                break;
+            addr += inst.len;
+
+            // the first jump back to the start closes the loop
+            const Parameter& target = inst.params.p1;
+            if (inst.opcode >= Opcode::Jmp && inst.opcode <= Opcode::Jle && target.mode >= ParamMode::Constant8
+                && target.mode <= ParamMode::Constant32 && target.value.u == start) {
+                loop.end  = addr;
+                loop.pure = true;
+                break;
+            }
+        }
+        return loop;
+    }
+
+    void CPU::check_idle_loop(mem_addr from) {
+        IdleLoop& loop = idle_loops[(p ^ (p >> 8U)) % IDLE_LOOP_CACHE_SIZE];
+        if (loop.start != p || loop.code_version != code_version) loop = examine_loop(p);
+        if (!loop.pure || from >= loop.end) {
+            idle_armed = false;
+            return;
+        }
+
+        materialize_r();
+        if (!idle_armed || idle_start != p || idle_registers != registers) {
+            idle_armed     = true;
+            idle_start     = p;
+            idle_registers = registers;
+            return;
+        }
+
+        // a whole iteration changed neither registers nor memory, so the loop spins until the next interrupt
+        ++stats.idle_loops;
+        uint64 now = stats.cycles();
+        if (!scheduled.empty() && scheduled.front().cycle > now) stats.idle += scheduled.front().cycle - now;
+        handle_interrupts();
+    }
+
+    void CPU::update_next_event() {
+        [[maybe_unused]] uint64 prev = next_event;
+        if (interrupts_enabled && pending_interrupts != 0) next_event = 0;
+        else next_event = scheduled.empty() ? NO_EVENT : scheduled.front().cycle;
+
+#ifdef TX8_JIT_SUPPORTED
+        // compiled loops only return to the run loop if interrupts may be handled
+        if (jit != nullptr && prev == NO_EVENT && next_event != NO_EVENT) jit->invalidate_all();
+#endif
+    }
+
+    void CPU::add_fusion(const Fusion& fusion) {
+        if (fusion.length < 2 || fusion.length > FUSION_MAX_LENGTH) return;
+        fusions.push_back(fusion);
+        invalidate_decode_cache();
+    }
+
+    void CPU::set_fusion_profiling(bool enabled) {
+        if (enabled) fusion_profile = std::make_unique<FusionProfile>();
+        else fusion_profile.reset();
+        invalidate_decode_cache();
+    }
+
+    void CPU::enable_jit(uint32 threshold) {
+#ifdef TX8_JIT_SUPPORTED
+        jit = std::make_unique<Jit>(*this, MAX(threshold, 1U));
+#endif
+    }
+
+    void CPU::disable_jit() { jit.reset(); }
+
+    std::vector<Fusion> CPU::derive_fusions(size_t count) const {
+        if (fusion_profile == nullptr) return {};
+
+        std::vector<std::pair<uint64, uint32>> pairs;
+        for (uint32 i = 0; i < fusion_profile->counts.size(); ++i) {
+            if (fusion_profile->counts[i] == 0) continue;
+
+            auto first  = (Opcode) (i >> 8U);
+            auto second = (Opcode) (i & 0xffU);
+            bool known  = std::any_of(fusions.begin(), fusions.end(), [&](const Fusion& f) {
+                return f.length == 2 && f.ops[0] == first && f.ops[1] == second;
+            });
+            if (!known) pairs.emplace_back(fusion_profile->counts[i], i);
+        }
+        std::sort(pairs.begin(), pairs.end(), std::greater<>());
+
+        std::vector<Fusion> derived;
+        for (size_t i = 0; i < pairs.size() && i < count; ++i)
+            derived.push_back({{(Opcode) (pairs[i].second >> 8U), (Opcode) (pairs[i].second & 0xffU)}, 2});
+        return derived;
+    }
+
+    void CPU::invalidate_decoded(mem_addr location, uint32 count) {
+        if (count == 0) return;
+
+        // a (fused) instruction starting up to DECODE_MAX_SPAN - 1 bytes before the location may overlap the write
+        mem_addr first = location < DECODE_MAX_SPAN - 1 ? 0 : location - (DECODE_MAX_SPAN - 1);
+        mem_addr last  = MIN(location + count - 1, MEM_SIZE - 1);
+
+        bool discarded = false;
+        for (uint32 page = first >> DECODE_PAGE_BITS; page <= last >> DECODE_PAGE_BITS; ++page) {
+            if (decode_cache[page] == nullptr) continue;
+
+            mem_addr from = MAX(first, page << DECODE_PAGE_BITS);
+            mem_addr to   = MIN(last, ((page + 1) << DECODE_PAGE_BITS) - 1);
+            for (mem_addr addr = from; addr <= to; ++addr) {
+                DecodedInstruction& slot = (*decode_cache[page])[addr & (DECODE_PAGE_SIZE - 1)];
+                discarded |= slot.inst.len != 0;
+                slot.inst.len = 0;
+                slot.entry    = nullptr;
+            }
+        }
+        if (discarded) {
+            ++code_version;
+            ++stats.invalidations;
+        }
+
+#ifdef TX8_JIT_SUPPORTED
+        if (jit != nullptr) jit->invalidate(location, last);
+#endif
+    }
+
+    void CPU::invalidate_decode_cache() {
+        // keep the pages, as running handlers and fused slots may still point into them
+        for (auto& page : decode_cache) {
+            if (page == nullptr) continue;
+            for (auto& slot : *page) {
+                slot.inst.len = 0;
+                slot.entry    = nullptr;
+            }
+        }
+        code_pages.fill(0);
+        ++code_version;
+
+#ifdef TX8_JIT_SUPPORTED
+        if (jit != nullptr) jit->invalidate_all();
+#endif
+    }
+
+    Snapshot CPU::snapshot() {
+        materialize_r();
+
+        if (snapshot_pages == nullptr) snapshot_pages = std::make_unique<SnapshotPages>();
+        SnapshotPages& pages = *snapshot_pages;
+        for (uint32 page : pages.saved) pages.slots[page] = SnapshotPages::NO_SLOT;
+        for (uint32 page : pages.dirty) pages.is_dirty[page] = false;
+        pages.saved.clear();
+        pages.contents.clear();
+        pages.dirty.clear();
+        ++pages.id;
+
+        return {
+            registers, rseed, halted, stopped, interrupts_enabled, pending_interrupts, scheduled, stats.cycles(), pages.id
+        };
+    }
+
+    void CPU::restore(const Snapshot& snap) {
+        if (snapshot_pages == nullptr || snap.id != snapshot_pages->id) {
+            error_raw("Cannot restore snapshot {}, only the latest snapshot of a cpu can be restored\n", snap.id);
+            return;
+        }
+
+        // pages stay saved, so they are not copied again when written after the restore
+        SnapshotPages& pages = *snapshot_pages;
+        for (uint32 page : pages.dirty) {
+            pages.is_dirty[page] = false;
+
+            mem_addr     addr  = page << SNAPSHOT_PAGE_BITS;
+            const uint8* saved = pages.contents.data() + (size_t) pages.slots[page] * SNAPSHOT_PAGE_SIZE;
+            uint32       count = MIN(SNAPSHOT_PAGE_SIZE, MEM_SIZE - addr);
+            // keep decoded instructions of pages that were written back to their original contents
+            if (memcmp(mem.data() + addr, saved, count) == 0) continue;
+
+            memcpy(mem.data() + addr, saved, count);
+            invalidate_decoded(addr, count);
+        }
+        pages.dirty.clear();
+
+        registers = snap.registers;
+        lazy_r.op = Opcode::Invalid;
+        rseed     = snap.rseed;
+        halted    = snap.halted;
+        stopped   = snap.stopped;
+
+        // scheduled interrupts keep their distance to the current cycle
+        interrupts_enabled = snap.interrupts_enabled;
+        pending_interrupts = snap.pending_interrupts;
+        scheduled          = snap.scheduled;
+        for (auto& event : scheduled) event.cycle = stats.cycles() + (event.cycle - snap.cycles);
+        idle_armed = false;
+        update_next_event();
+    }
+
+    void CPU::save_pages(mem_addr location, uint32 count) {
+        if (count == 0) return;
+
+        SnapshotPages& pages = *snapshot_pages;
+        for (uint32 page = location >> SNAPSHOT_PAGE_BITS; page <= (location + count - 1) >> SNAPSHOT_PAGE_BITS;
+             ++page) {
+            if (pages.is_dirty[page]) continue;
+            pages.is_dirty[page] = true;
+            pages.dirty.push_back(page);
+            if (pages.slots[page] != SnapshotPages::NO_SLOT) continue;
+
+            mem_addr addr     = page << SNAPSHOT_PAGE_BITS;
+            pages.slots[page] = (uint32) pages.saved.size();
+            pages.saved.push_back(page);
+            pages.contents.resize(pages.contents.size() + SNAPSHOT_PAGE_SIZE);
+            memcpy(pages.contents.data() + pages.contents.size() - SNAPSHOT_PAGE_SIZE, mem.data() + addr,
+                   MIN(SNAPSHOT_PAGE_SIZE, MEM_SIZE - addr));
+        }
+    }
+
     void CPU::exec_instruction(Instruction instruction) {
+#ifdef TX8_DISPATCH_FUNCTION
         op_function[(size_t) instruction.opcode](this, instruction.params);
+#else
+        (this->*op_handlers[(size_t) instruction.opcode])(instruction.params);
+#endif
     }
 
     void CPU::register_sysfunc(const std::string& name, Sysfunc func) {
         auto h = tx::str_hash(name);
 
-        if (sys_func_table.contains(h)) error(ERR_SYSFUNC_REREGISTER, name);
-        else sys_func_table[h] = std::move(func);
+        if (sysfunc_indices.contains(h)) error(ERR_SYSFUNC_REREGISTER, name);
+        else replace_sysfunc(name, std::move(func));
+    }
+
+    void CPU::replace_sysfunc(const std::string& name, Sysfunc func) {
+        auto [it, inserted] = sysfunc_indices.try_emplace(tx::str_hash(name), (uint32) sysfuncs.size());
+        // indices never change, so instructions resolved earlier call the replacement
+        if (inserted) sysfuncs.push_back(std::move(func));
+        else sysfuncs[it->second] = std::move(func);
     }
 
     void CPU::exec_sysfunc(uint32 hashed_name) {
-        auto it = sys_func_table.find(hashed_name);
-        if (it == sys_func_table.end()) error(ERR_SYSFUNC_NOT_FOUND, hashed_name);
+        auto it = sysfunc_indices.find(hashed_name);
+        if (it == sysfunc_indices.end()) error(ERR_SYSFUNC_NOT_FOUND, hashed_name);
         else {
-            Sysfunc f = it->second;
-            f(*this);
+            // sysfuncs access the registers directly
+            materialize_r();
+            sysfuncs[it->second](*this);
         }
     }
 
+    void CPU::resolve_sysfunc(DecodedInstruction& slot) {
+        const Parameter& p1 = slot.inst.params.p1;
+        if (p1.mode < ParamMode::Constant8 || p1.mode > ParamMode::Constant32) return;
+
+        // sysfuncs registered later are looked up by `op_sys` when the instruction runs
+        auto it = sysfunc_indices.find(get_param_value(p1));
+        if (it == sysfunc_indices.end()) return;
+        slot.inst.params.p2.value.u = it->second;
+        slot.handler                = &CPU::op_sys_indexed;
+    }
+
     // Returns the numerical value of a parameter
     uint32 CPU::get_param_value(Parameter param) {
         switch (param.mode) {
@@ -197,37 +769,152 @@ namespace tx {
 
     uint8* CPU::mem_get_ptr(mem_addr location) { return (location < MEM_SIZE) ? mem.data() + location : nullptr; }
 
-    void CPU::mem_write(mem_addr location, uint32 value, ValueSize size) {
-        uint8* p = mem.data() + (location & MEM_SIZE);
+    void CPU::mem_copy(mem_addr dst, mem_addr src, uint32 count) {
+        count = MIN(count, MEM_SIZE + 1);
+        dst &= MEM_SIZE;
+        src &= MEM_SIZE;
+        if (count == 0) return;
+
+        if (!mem_direct(src, count) || !mem_direct(dst, count)) {
+            // devices see byte by byte accesses, the whole source is still read first
+            std::vector<uint8> buffer(count);
+            for (uint32 i = 0; i < count; ++i) buffer[i] = mem_read<ValueSize::Byte>(src + i);
+            for (uint32 i = 0; i < count; ++i) mem_write<ValueSize::Byte>(dst + i, buffer[i]);
+            return;
+        }
 
-        auto bytes_to_write = (uint32) size;
-        if (MEM_SIZE - location < bytes_to_write) bytes_to_write = MEM_SIZE - location;
-        memcpy(p, &value, bytes_to_write);
+        if (dst + count <= MEM_SIZE && src + count <= MEM_SIZE) {
+            track_write(dst, count);
+            memmove(mem.data() + dst, mem.data() + src, count);
+            return;
+        }
+
+        // a range wraps around, read the whole source first, so overlapping ranges still behave like memmove
+        std::vector<uint8> buffer(count, 0);
+        mem_spans(src, count, [&](mem_addr addr, uint32 offset, uint32 length) {
+            memcpy(buffer.data() + offset, mem.data() + addr, length);
+        });
+        mem_spans(dst, count, [&](mem_addr addr, uint32 offset, uint32 length) {
+            track_write(addr, length);
+            memcpy(mem.data() + addr, buffer.data() + offset, length);
+        });
     }
 
-    uint32 CPU::mem_read(mem_addr location, ValueSize size) {
-        uint32 value = 0;
-        uint8* p     = mem.data() + (location & MEM_SIZE);
+    void CPU::mem_set(mem_addr location, uint8 value, uint32 count) {
+        count = MIN(count, MEM_SIZE + 1);
+        if (!mem_direct(location, count)) {
+            for (uint32 i = 0; i < count; ++i) mem_write<ValueSize::Byte>(location + i, value);
+            return;
+        }
+
+        mem_spans(location, count, [&](mem_addr addr, [[maybe_unused]] uint32 offset, uint32 length) {
+            track_write(addr, length);
+            memset(mem.data() + addr, value, length);
+        });
+    }
+
+    void CPU::map_device(mem_addr location, uint32 count, Device& device) {
+        bool aligned = ((location | count) & (BUS_PAGE_SIZE - 1)) == 0;
+        bool inside  = count > 0 && location < MEM_SIZE && count <= MEM_SIZE + 1 - location;
+        bool free    = std::none_of(devices.begin(), devices.end(), [&](const DeviceMapping& mapping) {
+            return location < mapping.first + mapping.count && mapping.first < location + count;
+        });
+        if (!aligned || !inside || !free) {
+            error(ERR_DEVICE_RANGE, count, location);
+            return;
+        }
+
+        devices.push_back({&device, location, count});
+        update_page_table();
+    }
+
+    void CPU::unmap_device(const Device& device) {
+        std::erase_if(devices, [&](const DeviceMapping& mapping) { return mapping.device == &device; });
+        update_page_table();
+    }
+
+    void CPU::update_page_table() {
+        std::fill(page_table.begin(), page_table.end(), mem.data());
+        for (const auto& mapping : devices) {
+            uint32 first = mapping.first >> BUS_PAGE_BITS;
+            uint32 last  = (mapping.first + mapping.count - 1) >> BUS_PAGE_BITS;
+            // accesses starting on the page before can reach into the device
+            for (uint32 page = first == 0 ? 0 : first - 1; page <= last; ++page) page_table[page] = nullptr;
+        }
+
+        // compiled code and cached instructions may have been read from the remapped pages
+        invalidate_decode_cache();
+    }
+
+    bool CPU::pages_direct(mem_addr location, uint32 count) const {
+        bool direct = true;
+        mem_spans(location, count, [&](mem_addr addr, [[maybe_unused]] uint32 offset, uint32 length) {
+            for (uint32 page = addr >> BUS_PAGE_BITS; page <= (addr + length - 1) >> BUS_PAGE_BITS; ++page)
+                direct &= page_table[page] != nullptr;
+        });
+        return direct;
+    }
+
+    const CPU::DeviceMapping* CPU::device_at(mem_addr location) const {
+        for (const auto& mapping : devices)
+            if (location - mapping.first < mapping.count) return &mapping;
+        return nullptr;
+    }
 
-        auto bytes_to_read = (uint32) size;
-        if (MEM_SIZE - location < bytes_to_read) bytes_to_read = MEM_SIZE - location;
-        memcpy(&value, p, bytes_to_read);
+    uint32 CPU::bus_read(mem_addr location, ValueSize size) {
+        const DeviceMapping* mapping = device_at(location);
+        if (mapping != nullptr && location - mapping->first + (uint32) size <= mapping->count)
+            return mapping->device->read(location - mapping->first, size);
 
+        // the access crosses the boundary of a device, split it into bytes (the byte at MEM_SIZE reads as 0)
+        uint32 value = 0;
+        for (uint32 i = 0; i < (uint32) size && location + i < MEM_SIZE; ++i) {
+            mem_addr addr = location + i;
+            mapping       = device_at(addr);
+            uint32 byte   = mapping != nullptr ? mapping->device->read(addr - mapping->first, ValueSize::Byte) & 0xffU
+                                               : mem[addr];
+            value |= byte << (i * 8);
+        }
         return value;
     }
 
+    void CPU::bus_write(mem_addr location, uint32 value, ValueSize size) {
+        const DeviceMapping* mapping = device_at(location);
+        if (mapping != nullptr && location - mapping->first + (uint32) size <= mapping->count) {
+            mapping->device->write(location - mapping->first, value, size);
+            return;
+        }
+
+        // the access crosses the boundary of a device, split it into bytes (writes to the byte at MEM_SIZE are ignored)
+        for (uint32 i = 0; i < (uint32) size && location + i < MEM_SIZE; ++i) {
+            mem_addr addr = location + i;
+            auto     byte = (uint8) (value >> (i * 8));
+            mapping       = device_at(addr);
+            if (mapping != nullptr) {
+                mapping->device->write(addr - mapping->first, byte, ValueSize::Byte);
+            } else {
+                track_write(addr, 1);
+                mem[addr] = byte;
+            }
+        }
+    }
+
     void   CPU::mem_write_rel(mem_addr location, uint32 value, ValueSize size) { mem_write(o + location, value, size); }
     uint32 CPU::mem_read_rel(mem_addr location, ValueSize size) { return mem_read(o + location, size); }
 
     void CPU::reg_write(Register which, uint32 value) {
         uint32 id = ((uint32) which) & REG_ID_MASK;
         if (id > REGISTER_COUNT) error(ERR_INVALID_REG_ID, id);
-        else switch (((uint32) which) & REG_SIZE_MASK) {
+        else {
+            // small register writes keep the upper bytes of a pending R register value
+            if (id == (uint32) Register::R) materialize_r();
+            switch (((uint32) which) & REG_SIZE_MASK) {
                 case REG_SIZE_1: *((uint8*) (registers.data() + id)) = (uint8) value; break;
                 case REG_SIZE_2: *((uint16*) (registers.data() + id)) = (uint16) value; break;
                 case REG_SIZE_4: *((uint32*) (registers.data() + id)) = (uint32) value; break;
                 default: error(ERR_INVALID_REG_SIZE, id); break;
             }
+        }
     }
 
     uint32 CPU::reg_read(Register which) {
@@ -236,7 +923,10 @@ namespace tx {
         if (id > REGISTER_COUNT) error(ERR_INVALID_REG_ID, id);
         // because REG_SIZE_4 is 0x00, the only valid register sizes are 0x00, 0x10 and 0x20
         else if (size > REG_SIZE_2) error(ERR_INVALID_REG_SIZE, id);
-        else return registers[id] & register_mask[size >> 4U];
+        else {
+            if (id == (uint32) Register::R) materialize_r();
+            return registers[id] & register_mask[size >> 4U];
+        }
         return 0;
     }
 
@@ -311,6 +1001,11 @@ namespace tx {
     void CPU::op_ret(const Parameters& params) { jump(pop()); }
 
     void CPU::op_sys(const Parameters& params) { exec_sysfunc(PARAMV(1)); }
+    void CPU::op_sys_indexed(const Parameters& params) {
+        // sysfuncs access the registers directly
+        materialize_r();
+        sysfuncs[params.p2.value.u](*this);
+    }
 
 #define LD(name, type) \
     void CPU::op_##name(const Parameters& params) { \
@@ -474,37 +1169,13 @@ namespace tx {
 #define RF(x) \
     num32 __rf = {.f = (x)}; \
     write_r(__rf.u)
-#define R_SIZES(one, half, full) \
-    if (param_is_register(params.p1.mode)) { \
-        uint32 reg = params.p1.value.u; \
-        switch (reg & REG_SIZE_MASK) { \
-            case REG_SIZE_1: R((one)); break; \
-            case REG_SIZE_2: R((half)); break; \
-            case REG_SIZE_4: R((full)); break; \
-            default: break; \
-        } \
-    } else R((full))
-
-#define AR_OVF_OP(name, type) \
-    type(name) uint32 rval; \
-    ValueSize         size = ValueSize::Word; \
-    if (param_is_register(params.p1.mode)) size = register_size((Register) params.p1.value.u); \
-    switch (size) { \
-        case ValueSize::Byte: \
-            rval = __builtin_##name##_overflow((uint8) a.u, (uint8) b.u, (uint8*) (&result.u)); \
-            rval |= __builtin_##name##_overflow((int8) a.i, (int8) b.i, (int8*) (&result.i)) << 1; \
-            break; \
-        case ValueSize::Short: \
-            rval = __builtin_##name##_overflow((uint16) a.u, (uint16) b.u, (uint16*) (&result.u)); \
-            rval |= __builtin_##name##_overflow((int16) a.i, (int16) b.i, (int16*) (&result.i)) << 1; \
-            break; \
-        case ValueSize::Word: \
-            rval = __builtin_##name##_overflow(a.u, b.u, &result.u); \
-            rval |= __builtin_##name##_overflow(a.i, b.i, &result.i) << 1; \
-            break; \
-    } \
+// Size of the destination parameter
+#define DEST_SIZE (param_is_register(params.p1.mode) ? register_size((Register) params.p1.value.u) : ValueSize::Word)
+// Calculates `a op b`, leaving the overflow flags in the size of the destination to be computed once R is read
+#define AR_OVF_OP(name, op, type) \
+    type(name) result.u = Opcode::op == Opcode::Add ? a.u + b.u : a.u - b.u; \
     AR_OP_END \
-    R(rval);
+    set_lazy_r(Opcode::op, DEST_SIZE, a.u, b.u);
 
 #define AR_OVF_MUL(name, type, vtype, m) \
     m(name) type##64_t a_64 = a.vtype; \
@@ -522,11 +1193,8 @@ namespace tx {
             result.u++;
             if (param_is_register(params.p1.mode)) result.u &= register_mask[(params.p1.value.u & REG_SIZE_MASK) >> 4u];
         AR_OP_END
-        R_SIZES(
-            ((result.u == (uint8) INT8_MIN) << 1u) | (result.u == 0),
-            ((result.u == (uint16) INT16_MIN) << 1u) | (result.u == 0),
-            ((result.u == (uint32) INT32_MIN) << 1u) | (result.u == 0)
-        );
+        // the overflow flags of inc are the ones of adding 1
+        set_lazy_r(Opcode::Add, DEST_SIZE, a.u, 1);
     }
     void CPU::op_dec(const Parameters& params) {
         AR_UOP_1_BEGIN(dec)
@@ -534,14 +1202,11 @@ namespace tx {
             result.u--;
             if (param_is_register(params.p1.mode)) result.u &= register_mask[(params.p1.value.u & REG_SIZE_MASK) >> 4u];
         AR_OP_END
-        R_SIZES(
-            ((result.u == (uint8) INT8_MAX) << 1u) | (result.u == UINT8_MAX),
-            ((result.u == (uint16) INT16_MAX) << 1u) | (result.u == UINT16_MAX),
-            ((result.u == (uint32) INT32_MAX) << 1u) | (result.u == UINT32_MAX)
-        );
-    }
-    void CPU::op_add(const Parameters& params) { AR_OVF_OP(add, AR_OP_2_BEGIN) }
-    void CPU::op_sub(const Parameters& params) { AR_OVF_OP(sub, AR_OP_2_BEGIN) }
+        // the overflow flags of dec are the ones of subtracting 1
+        set_lazy_r(Opcode::Sub, DEST_SIZE, a.u, 1);
+    }
+    void CPU::op_add(const Parameters& params) { AR_OVF_OP(add, Add, AR_OP_2_BEGIN) }
+    void CPU::op_sub(const Parameters& params) { AR_OVF_OP(sub, Sub, AR_OP_2_BEGIN) }
     void CPU::op_mul(const Parameters& params) { AR_OVF_MUL(mul, int, i, AR_OP_2_BEGIN) }
     void CPU::op_div(const Parameters& params) {
         AR_OP_2_BEGIN("div")
@@ -698,8 +1363,94 @@ namespace tx {
     void CPU::op_log2(const Parameters& params) { AR_FUN_FOP_1("log2", log2f) }
     void CPU::op_log10(const Parameters& params) { AR_FUN_FOP_1("log10", log10f) }
 
-    void CPU::op_uadd(const Parameters& params) { AR_OVF_OP(add, AR_UOP_2_BEGIN) }
-    void CPU::op_usub(const Parameters& params) { AR_OVF_OP(sub, AR_UOP_2_BEGIN) }
+    // bulk memory operations, the source of mcpy is in register A and the fill byte of mset in register B
+    void CPU::op_mcpy(const Parameters& params) { mem_copy(PARAMV(1), a, PARAMV(2)); }
+    void CPU::op_mset(const Parameters& params) { mem_set(PARAMV(1), (uint8) b, PARAMV(2)); }
+
+    Vec4 CPU::vec_read(mem_addr location) {
+        Vec4 vec;
+        location &= MEM_SIZE;
+        if (location + sizeof(Vec4) <= MEM_SIZE && mem_direct(location, sizeof(Vec4))) {
+            memcpy(vec.data(), mem.data() + location, sizeof(Vec4));
+        } else {
+            for (uint32 i = 0; i < vec.size(); ++i) {
+                num32 lane = {.u = mem_read((location + i * 4) & MEM_SIZE)};
+                vec[i]     = lane.f;
+            }
+        }
+        return vec;
+    }
+
+    void CPU::vec_write(mem_addr location, const Vec4& vec) {
+        location &= MEM_SIZE;
+        if (location + sizeof(Vec4) <= MEM_SIZE && mem_direct(location, sizeof(Vec4))) {
+            track_write(location, sizeof(Vec4));
+            memcpy(mem.data() + location, vec.data(), sizeof(Vec4));
+        } else {
+            for (uint32 i = 0; i < vec.size(); ++i) {
+                num32 lane = {.f = vec[i]};
+                mem_write((location + i * 4) & MEM_SIZE, lane.u);
+            }
+        }
+    }
+
+    // vector operations on the four float32 lanes at the addresses p1 and p2, the result is stored at p1
+    // the SSE versions compute exactly the same lanes as the scalar fallbacks
+#ifdef TX8_VECTOR_SSE
+#define VEC_LANES(sse, scalar) _mm_storeu_ps(x.data(), sse(_mm_loadu_ps(x.data()), _mm_loadu_ps(y.data())));
+#else
+#define VEC_LANES(sse, scalar) \
+    for (uint32 i = 0; i < x.size(); ++i) x[i] = scalar(x[i], y[i]);
+#endif
+#define VEC_OP_2(sse, scalar) \
+    mem_addr dst = PARAMV(1); \
+    Vec4     x   = vec_read(dst); \
+    Vec4     y   = vec_read(PARAMV(2)); \
+    VEC_LANES(sse, scalar) \
+    vec_write(dst, x);
+#define VEC_ADD(x, y) ((x) + (y))
+#define VEC_MUL(x, y) ((x) * (y))
+
+    void CPU::op_vadd(const Parameters& params) { VEC_OP_2(_mm_add_ps, VEC_ADD) }
+    void CPU::op_vmul(const Parameters& params) { VEC_OP_2(_mm_mul_ps, VEC_MUL) }
+    void CPU::op_vmin(const Parameters& params) { VEC_OP_2(_mm_min_ps, MIN) }
+    void CPU::op_vmax(const Parameters& params) { VEC_OP_2(_mm_max_ps, MAX) }
+
+    void CPU::op_vfma(const Parameters& params) {
+        // p1 := p1 + p2 * A, the product is rounded before the addition like with separate fmul and fadd instructions
+        num32    factor = {.u = a};
+        mem_addr dst    = PARAMV(1);
+        Vec4     x      = vec_read(dst);
+        Vec4     y      = vec_read(PARAMV(2));
+#ifdef TX8_VECTOR_SSE
+        __m128 product = _mm_mul_ps(_mm_loadu_ps(y.data()), _mm_set1_ps(factor.f));
+        _mm_storeu_ps(x.data(), _mm_add_ps(_mm_loadu_ps(x.data()), product));
+#else
+        for (uint32 i = 0; i < x.size(); ++i) x[i] += y[i] * factor.f;
+#endif
+        vec_write(dst, x);
+    }
+
+    void CPU::op_vdot(const Parameters& params) {
+        // A := p1 . p2, the products are summed from the first to the last lane
+        Vec4 x = vec_read(PARAMV(1));
+        Vec4 y = vec_read(PARAMV(2));
+#ifdef TX8_VECTOR_SSE
+        _mm_storeu_ps(x.data(), _mm_mul_ps(_mm_loadu_ps(x.data()), _mm_loadu_ps(y.data())));
+#else
+        for (uint32 i = 0; i < x.size(); ++i) x[i] *= y[i];
+#endif
+        num32 result = {.f = ((x[0] + x[1]) + x[2]) + x[3]};
+        a            = result.u;
+    }
+
+#undef VEC_MUL
+#undef VEC_ADD
+#undef VEC_OP_2
+#undef VEC_LANES
+
+    void CPU::op_uadd(const Parameters& params) { AR_OVF_OP(add, Add, AR_UOP_2_BEGIN) }
+    void CPU::op_usub(const Parameters& params) { AR_OVF_OP(sub, Sub, AR_UOP_2_BEGIN) }
     void CPU::op_umul(const Parameters& params) { AR_OVF_MUL(umul, uint, u, AR_UOP_2_BEGIN); }
     void CPU::op_udiv(const Parameters& params) {
         AR_UOP_2_BEGIN("udiv")
@@ -757,20 +1508,372 @@ namespace tx {
             result.u = (uint32) a.f;
         AR_OP_END
     }
-    void CPU::op_ei(const Parameters& params) { }
-    void CPU::op_di(const Parameters& params) { }
+    void CPU::op_ei(const Parameters& params) {
+        interrupts_enabled = true;
+        update_next_event();
+    }
+
+    void CPU::op_di(const Parameters& params) {
+        interrupts_enabled = false;
+        update_next_event();
+    }
+
     void CPU::op_stop(const Parameters& params) { stopped = true; }
 
+    // Specialized operations
+    // `select_handler` picks these for instructions whose parameters are constants or valid registers. Parameter modes
+    // and the destination register size are template arguments, so the handlers compile down to the bare operation.
+
+    /// Truncate a value to the given size
+    template <ValueSize size>
+    static inline uint32 truncate(uint32 value) {
+        if constexpr (size == ValueSize::Byte) return (uint8) value;
+        else if constexpr (size == ValueSize::Short) return (uint16) value;
+        else return value;
+    }
+
+    /// Truncate a value to the given size and sign extend it back to 32 bits
+    template <ValueSize size>
+    static inline uint32 sign_extend(uint32 value) {
+        if constexpr (size == ValueSize::Byte) return (int32) (int8) value;
+        else if constexpr (size == ValueSize::Short) return (int32) (int16) value;
+        else return value;
+    }
+
+    /// Write the lower bytes of a value into a register, keeping its upper bytes
+    template <ValueSize size>
+    static inline void store(uint32& reg, uint32 value) {
+        if constexpr (size == ValueSize::Byte) *((uint8*) &reg) = (uint8) value;
+        else if constexpr (size == ValueSize::Short) *((uint16*) &reg) = (uint16) value;
+        else reg = value;
+    }
+
+    /// Get the R register overflow flags of `a op b` (Opcode::Add or Opcode::Sub) calculated in the given size
+    template <Opcode op, ValueSize size>
+    static inline uint32 overflow_flags(uint32 a, uint32 b) {
+        using U = std::conditional_t<
+            size == ValueSize::Byte,
+            uint8,
+            std::conditional_t<size == ValueSize::Short, uint16, uint32>>;
+        using I = std::make_signed_t<U>;
+        U      ures;
+        I      ires;
+        uint32 rval;
+        if constexpr (op == Opcode::Add) {
+            rval = __builtin_add_overflow((U) a, (U) b, &ures);
+            rval |= __builtin_add_overflow((I) a, (I) b, &ires) << 1;
+        } else {
+            rval = __builtin_sub_overflow((U) a, (U) b, &ures);
+            rval |= __builtin_sub_overflow((I) a, (I) b, &ires) << 1;
+        }
+        return rval;
+    }
+
+    void CPU::compute_lazy_r() {
+        const auto& [op, size, a, b] = lazy_r;
+        bool add                     = op == Opcode::Add;
+        switch (size) {
+            case ValueSize::Byte:
+                write_r(add ? overflow_flags<Opcode::Add, ValueSize::Byte>(a, b)
+                            : overflow_flags<Opcode::Sub, ValueSize::Byte>(a, b));
+                break;
+            case ValueSize::Short:
+                write_r(add ? overflow_flags<Opcode::Add, ValueSize::Short>(a, b)
+                            : overflow_flags<Opcode::Sub, ValueSize::Short>(a, b));
+                break;
+            default:
+                write_r(add ? overflow_flags<Opcode::Add, ValueSize::Word>(a, b)
+                            : overflow_flags<Opcode::Sub, ValueSize::Word>(a, b));
+                break;
+        }
+    }
+
+    /// Read a constant or register parameter in a fixed parameter mode
+    template <ParamMode mode, bool sign_extended>
+    static inline uint32 spec_param(const std::array<uint32, REGISTER_COUNT>& registers, const Parameter& param) {
+        if constexpr (mode == ParamMode::Register) {
+            uint32 reg   = param.value.u;
+            uint32 value = registers[reg & REG_ID_MASK] & register_mask[(reg & REG_SIZE_MASK) >> 4U];
+            if constexpr (sign_extended) {
+                uint32 shift = (reg & REG_SIZE_1) ? 24 : (reg & REG_SIZE_2) ? 16 : 0;
+                value        = (uint32) (((int32) (value << shift)) >> shift);
+            }
+            return value;
+        } else if constexpr (sign_extended && mode == ParamMode::Constant8) {
+            return sign_extend<ValueSize::Byte>(param.value.u);
+        } else if constexpr (sign_extended && mode == ParamMode::Constant16) {
+            return sign_extend<ValueSize::Short>(param.value.u);
+        } else {
+            return param.value.u;
+        }
+    }
+
+    /// Check if the conditional jump `op` is taken for the given R register value
+    template <Opcode op>
+    static inline bool jump_condition(int32 rval) {
+        if constexpr (op == Opcode::Jeq) return rval == 0;
+        else if constexpr (op == Opcode::Jne) return rval != 0;
+        else if constexpr (op == Opcode::Jgt) return rval > 0;
+        else if constexpr (op == Opcode::Jge) return rval >= 0;
+        else if constexpr (op == Opcode::Jlt) return rval < 0;
+        else return rval <= 0;
+    }
+
+    template <Opcode op, ParamMode mode_p1, ParamMode mode_p2, ValueSize size>
+    void CPU::op_spec(const Parameters& params) {
+        if constexpr (op == Opcode::Jmp) {
+            p = params.p1.value.u;
+        } else if constexpr (op >= Opcode::Jeq && op <= Opcode::Jle) {
+            materialize_r();
+            if (jump_condition<op>((int32) r)) p = params.p1.value.u;
+        } else {
+            static_assert(mode_p1 == ParamMode::Register);
+            constexpr bool is_signed = op == Opcode::Add || op == Opcode::Sub || op == Opcode::Cmp || op == Opcode::Lds;
+
+            uint32& dest = registers[params.p1.value.u & REG_ID_MASK];
+            uint32  a    = is_signed ? sign_extend<size>(dest) : truncate<size>(dest);
+            uint32  b    = spec_param<mode_p2, is_signed>(registers, params.p2);
+
+            if constexpr (op == Opcode::Ld || op == Opcode::Lds) store<size>(dest, b);
+            else if constexpr (op == Opcode::And) store<size>(dest, a & b);
+            else if constexpr (op == Opcode::Or) store<size>(dest, a | b);
+            else if constexpr (op == Opcode::Xor) store<size>(dest, a ^ b);
+            else if constexpr (op == Opcode::Cmp) write_r(CMP((int32) a, (int32) b));
+            else if constexpr (op == Opcode::Ucmp) write_r(CMP(a, b));
+            else if constexpr (op == Opcode::Inc || op == Opcode::Dec) {
+                // the overflow flags of inc / dec are the ones of adding / subtracting 1
+                constexpr Opcode kind = op == Opcode::Inc ? Opcode::Add : Opcode::Sub;
+                store<size>(dest, kind == Opcode::Add ? a + 1 : a - 1);
+                set_lazy_r(kind, size, a, 1);
+            } else {
+                static_assert(op == Opcode::Add || op == Opcode::Sub || op == Opcode::Uadd || op == Opcode::Usub);
+                constexpr Opcode kind = op == Opcode::Add || op == Opcode::Uadd ? Opcode::Add : Opcode::Sub;
+                store<size>(dest, kind == Opcode::Add ? a + b : a - b);
+                set_lazy_r(kind, size, a, b);
+            }
+        }
+    }
+
+// Pointers to the specializations of an opcode for every destination register size
+#define SPEC_SIZES(op, mode_p2) \
+    &CPU::op_spec<Opcode::op, ParamMode::Register, mode_p2, ValueSize::Byte>, \
+        &CPU::op_spec<Opcode::op, ParamMode::Register, mode_p2, ValueSize::Short>, \
+        &CPU::op_spec<Opcode::op, ParamMode::Register, mode_p2, ValueSize::Word>
+// Pointers to the specializations of a two parameter opcode, indexed by `spec_index`
+#define SPEC_TABLE(op) \
+    std::array<OpHandler, 12> { \
+        SPEC_SIZES(op, ParamMode::Constant8), SPEC_SIZES(op, ParamMode::Constant16), \
+            SPEC_SIZES(op, ParamMode::Constant32), SPEC_SIZES(op, ParamMode::Register) \
+    }
+#define SPEC_JUMP(op) &CPU::op_spec<Opcode::op, ParamMode::Constant32, ParamMode::Unused, ValueSize::Word>
+
+    /// Check if a parameter is a register the specialized handlers can access without further checks
+    /// (not R, which may have a pending value, see `CPU::materialize_r`)
+    static inline bool spec_register_valid(const Parameter& param) {
+        uint32 id = param.value.u & REG_ID_MASK;
+        return param.mode == ParamMode::Register && id < REGISTER_COUNT && id != (uint32) Register::R
+               && (param.value.u & REG_SIZE_MASK) <= REG_SIZE_2;
+    }
+
+    OpHandler CPU::select_handler(const Instruction& inst) {
+        OpHandler generic = op_handlers[(size_t) inst.opcode];
+        const auto& [p1, p2] = inst.params;
+
+        switch (inst.opcode) {
+            case Opcode::Jmp:
+                if (p1.mode < ParamMode::Constant8 || p1.mode > ParamMode::Constant32) return generic;
+                return SPEC_JUMP(Jmp);
+            case Opcode::Jeq:
+            case Opcode::Jne:
+            case Opcode::Jgt:
+            case Opcode::Jge:
+            case Opcode::Jlt:
+            case Opcode::Jle: {
+                static constexpr std::array<OpHandler, 6> jumps = {
+                    SPEC_JUMP(Jeq), SPEC_JUMP(Jne), SPEC_JUMP(Jgt), SPEC_JUMP(Jge), SPEC_JUMP(Jlt), SPEC_JUMP(Jle)};
+                if (p1.mode < ParamMode::Constant8 || p1.mode > ParamMode::Constant32) return generic;
+                return jumps[(size_t) inst.opcode - (size_t) Opcode::Jeq];
+            }
+            default: break;
+        }
+
+        if (!spec_register_valid(p1)) return generic;
+        uint32 p1_size    = p1.value.u & REG_SIZE_MASK;
+        size_t size_index = p1_size == REG_SIZE_1 ? 0 : p1_size == REG_SIZE_2 ? 1 : 2;
+
+        if (inst.opcode == Opcode::Inc || inst.opcode == Opcode::Dec) {
+            static constexpr std::array<OpHandler, 3> incs = {SPEC_SIZES(Inc, ParamMode::Unused)};
+            static constexpr std::array<OpHandler, 3> decs = {SPEC_SIZES(Dec, ParamMode::Unused)};
+            return (inst.opcode == Opcode::Inc ? incs : decs)[size_index];
+        }
+
+        size_t mode_index;
+        switch (p2.mode) {
+            case ParamMode::Constant8: mode_index = 0; break;
+            case ParamMode::Constant16: mode_index = 1; break;
+            case ParamMode::Constant32: mode_index = 2; break;
+            case ParamMode::Register:
+                if (!spec_register_valid(p2)) return generic;
+                mode_index = 3;
+                break;
+            default: return generic;
+        }
+        size_t spec_index = mode_index * 3 + size_index;
+
+        switch (inst.opcode) {
+            case Opcode::Ld: {
+                static constexpr auto table = SPEC_TABLE(Ld);
+                return table[spec_index];
+            }
+            case Opcode::Lds: {
+                static constexpr auto table = SPEC_TABLE(Lds);
+                return table[spec_index];
+            }
+            case Opcode::Cmp: {
+                static constexpr auto table = SPEC_TABLE(Cmp);
+                return table[spec_index];
+            }
+            case Opcode::Ucmp: {
+                static constexpr auto table = SPEC_TABLE(Ucmp);
+                return table[spec_index];
+            }
+            case Opcode::Add: {
+                static constexpr auto table = SPEC_TABLE(Add);
+                return table[spec_index];
+            }
+            case Opcode::Sub: {
+                static constexpr auto table = SPEC_TABLE(Sub);
+                return table[spec_index];
+            }
+            case Opcode::Uadd: {
+                static constexpr auto table = SPEC_TABLE(Uadd);
+                return table[spec_index];
+            }
+            case Opcode::Usub: {
+                static constexpr auto table = SPEC_TABLE(Usub);
+                return table[spec_index];
+            }
+            case Opcode::And: {
+                static constexpr auto table = SPEC_TABLE(And);
+                return table[spec_index];
+            }
+            case Opcode::Or: {
+                static constexpr auto table = SPEC_TABLE(Or);
+                return table[spec_index];
+            }
+            case Opcode::Xor: {
+                static constexpr auto table = SPEC_TABLE(Xor);
+                return table[spec_index];
+            }
+            default: return generic;
+        }
+    }
+
+    template <OpHandler first, Opcode jump>
+    void CPU::op_fused_jump(const Parameters& params) {
+        mem_addr start = p;
+        (this->*first)(params);
+        if (p != start) return;
+
+        // `first` only touches registers, so the jump following it is still the one in `current->next`
+        const Instruction& inst = current->next->inst;
+        mem_addr           addr = start + current->inst.len;
+        ++stats.fused;
+        (*sinks.debug)("[cpu] [#{:x}] {}\n", addr, inst);
+
+        materialize_r();
+        p = jump_condition<jump>((int32) r) ? inst.params.p1.value.u : addr;
+        if (p == addr) p += inst.len;
+    }
+
+// A specialized handler together with its fusions with each conditional jump
+#define FUSED_JUMPS(...) \
+    std::pair<OpHandler, std::array<OpHandler, 6>> { \
+        __VA_ARGS__, { \
+            &CPU::op_fused_jump<__VA_ARGS__, Opcode::Jeq>, &CPU::op_fused_jump<__VA_ARGS__, Opcode::Jne>, \
+                &CPU::op_fused_jump<__VA_ARGS__, Opcode::Jgt>, &CPU::op_fused_jump<__VA_ARGS__, Opcode::Jge>, \
+                &CPU::op_fused_jump<__VA_ARGS__, Opcode::Jlt>, &CPU::op_fused_jump<__VA_ARGS__, Opcode::Jle> \
+        } \
+    }
+#define FUSED_SIZES(op, mode_p2) \
+    FUSED_JUMPS(&CPU::op_spec<Opcode::op, ParamMode::Register, mode_p2, ValueSize::Byte>), \
+        FUSED_JUMPS(&CPU::op_spec<Opcode::op, ParamMode::Register, mode_p2, ValueSize::Short>), \
+        FUSED_JUMPS(&CPU::op_spec<Opcode::op, ParamMode::Register, mode_p2, ValueSize::Word>)
+#define FUSED_MODES(op) \
+    FUSED_SIZES(op, ParamMode::Constant8), FUSED_SIZES(op, ParamMode::Constant16), \
+        FUSED_SIZES(op, ParamMode::Constant32), FUSED_SIZES(op, ParamMode::Register)
+
+    OpHandler CPU::select_fused_jump(OpHandler first, const DecodedInstruction& jump) {
+        // clang-format off
+        static const std::array<std::pair<OpHandler, std::array<OpHandler, 6>>, 30> fused_jumps = {
+            FUSED_MODES(Cmp), FUSED_MODES(Ucmp),
+            FUSED_SIZES(Inc, ParamMode::Unused), FUSED_SIZES(Dec, ParamMode::Unused),
+        };
+        // clang-format on
+
+        // only jumps to constant addresses are specialized
+        if (jump.inst.opcode >= Opcode::Jeq && jump.inst.opcode <= Opcode::Jle
+            && jump.handler != op_handlers[(size_t) jump.inst.opcode]) {
+            for (const auto& [handler, fused] : fused_jumps)
+                if (handler == first) return fused[(size_t) jump.inst.opcode - (size_t) Opcode::Jeq];
+        }
+        return &CPU::op_fused<2>;
+    }
+
+#undef SPEC_SIZES
+#undef SPEC_TABLE
+#undef SPEC_JUMP
+#undef FUSED_JUMPS
+#undef FUSED_SIZES
+#undef FUSED_MODES
+
     // Invalid operation
-    void CPU::op_inv(const Parameters& params) { tx::log_err("Invalid opcode at #{:x}: {:x}", p, mem[p]); }
+    void CPU::op_inv(const Parameters& params) { (*sinks.err)("Invalid opcode at #{:x}: {:x}", p, mem[p]); }
+
+// clang-format off
+const std::array<OpHandler, 256> CPU::op_handlers = {
+        // 0x0
+        &CPU::op_hlt, &CPU::op_nop, &CPU::op_jmp, &CPU::op_jeq, &CPU::op_jne, &CPU::op_jgt, &CPU::op_jge, &CPU::op_jlt, &CPU::op_jle, &CPU::op_cmp, &CPU::op_fcmp, &CPU::op_ucmp, &CPU::op_call, &CPU::op_ret, &CPU::op_sys, &CPU::op_inv,
+        // 0x1
+        &CPU::op_ld, &CPU::op_lds, &CPU::op_lw, &CPU::op_lws, &CPU::op_lda, &CPU::op_sta, &CPU::op_ldb, &CPU::op_stb, &CPU::op_ldc, &CPU::op_stc, &CPU::op_ldd, &CPU::op_std, &CPU::op_zero, &CPU::op_push, &CPU::op_pop, &CPU::op_inv,
+        // 0x2
+        &CPU::op_inc, &CPU::op_dec, &CPU::op_add, &CPU::op_sub, &CPU::op_mul, &CPU::op_div, &CPU::op_mod, &CPU::op_max, &CPU::op_min, &CPU::op_abs, &CPU::op_sign, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0x3
+        &CPU::op_and, &CPU::op_or, &CPU::op_not, &CPU::op_nand, &CPU::op_xor, &CPU::op_slr, &CPU::op_sar, &CPU::op_sll, &CPU::op_ror, &CPU::op_rol, &CPU::op_set, &CPU::op_clr, &CPU::op_tgl, &CPU::op_test, &CPU::op_inv,  &CPU::op_inv,
+        // 0x4
+        &CPU::op_finc, &CPU::op_fdec, &CPU::op_fadd, &CPU::op_fsub, &CPU::op_fmul, &CPU::op_fdiv, &CPU::op_fmod, &CPU::op_fmax, &CPU::op_fmin, &CPU::op_fabs, &CPU::op_fsign, &CPU::op_sin, &CPU::op_cos, &CPU::op_tan, &CPU::op_asin, &CPU::op_acos,
+        // 0x5
+        &CPU::op_atan, &CPU::op_atan2, &CPU::op_sqrt, &CPU::op_pow, &CPU::op_exp, &CPU::op_log, &CPU::op_log2, &CPU::op_log10, &CPU::op_mcpy, &CPU::op_mset, &CPU::op_vadd, &CPU::op_vmul, &CPU::op_vfma, &CPU::op_vdot, &CPU::op_vmin, &CPU::op_vmax,
+        // 0x6
+        &CPU::op_uadd, &CPU::op_usub, &CPU::op_umul, &CPU::op_udiv, &CPU::op_umod, &CPU::op_umax, &CPU::op_umin, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0x7
+        &CPU::op_rand, &CPU::op_rseed, &CPU::op_itf, &CPU::op_fti, &CPU::op_utf, &CPU::op_ftu, &CPU::op_ei, &CPU::op_di, &CPU::op_stop, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0x8
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0x9
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0xa
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0xb
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0xc
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0xd
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0xe
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+        // 0xf
+        &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv, &CPU::op_inv,
+    };
+    // clang-format on
 
 } // namespace tx
 
+#undef DEST_SIZE
 #undef AR_OVF_OP
 #undef AR_OVF_MUL
 
 #undef R
-#undef R_SIZES
 
 #undef PARAMV
 #undef PARAMA
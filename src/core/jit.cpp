@@ -0,0 +1,648 @@
+#include "tx8/core/jit.hpp"
+
+#include "tx8/core/cpu.hpp"
+#include "tx8/core/instruction.hpp"
+#include "tx8/core/log.hpp"
+#include "tx8/core/types.hpp"
+
+#ifdef TX8_JIT_SUPPORTED
+
+#include <cstring>
+#include <sys/mman.h>
+#include <tuple>
+
+namespace tx {
+    // x86-64 general purpose register numbers
+    const uint8 RAX = 0;
+    const uint8 RCX = 1;
+    const uint8 RDX = 2;
+    const uint8 RBX = 3;
+    const uint8 RBP = 5;
+    const uint8 RSI = 6;
+    const uint8 RDI = 7;
+    const uint8 R8  = 8;
+    const uint8 R9  = 9;
+    const uint8 R10 = 10;
+    const uint8 R11 = 11;
+    const uint8 R12 = 12;
+    const uint8 R13 = 13;
+    const uint8 R14 = 14;
+    const uint8 R15 = 15;
+
+    // x86-64 condition codes
+    const uint8 CC_O  = 0x0;
+    const uint8 CC_B  = 0x2;
+    const uint8 CC_E  = 0x4;
+    const uint8 CC_NE = 0x5;
+    const uint8 CC_A  = 0x7;
+    const uint8 CC_L  = 0xc;
+    const uint8 CC_GE = 0xd;
+    const uint8 CC_LE = 0xe;
+    const uint8 CC_G  = 0xf;
+
+    // Register usage of compiled blocks:
+    // - the tx8 registers except p live in the host registers below (p is a constant for every instruction)
+    // - R15 holds the cpu register array, R14 the cpu memory and RBP the cpu
+    // - RAX, RCX, RDX, RSI and RDI are scratch registers
+
+    /// Marks tx8 registers without a host register
+    const uint8 NO_HOST_REG = 0xff;
+    /// Host registers of the tx8 registers a, b, c, d, r, o, p and s
+    const std::array<uint8, REGISTER_COUNT> host_regs = {R8, R9, R10, R11, R12, R13, NO_HOST_REG, RBX};
+    /// Host register of the tx8 R register
+    const uint8 HOST_R = R12;
+    /// Host register of the tx8 O register
+    const uint8 HOST_O = R13;
+
+    // "op r/m32, r32" opcodes
+    const uint8 OP_ADD  = 0x01;
+    const uint8 OP_OR   = 0x09;
+    const uint8 OP_AND  = 0x21;
+    const uint8 OP_SUB  = 0x29;
+    const uint8 OP_XOR  = 0x31;
+    const uint8 OP_CMP  = 0x39;
+    const uint8 OP_TEST = 0x85;
+    const uint8 OP_MOV  = 0x89;
+
+    /// Minimal x86-64 machine code emitter; operations work on 32 bit registers unless stated otherwise
+    class Emitter {
+      public:
+        std::vector<uint8> code;
+
+        inline size_t pos() const { return code.size(); }
+
+        void byte(uint8 b) { code.push_back(b); }
+
+        void dword(uint32 v) {
+            for (uint32 i = 0; i < 4; ++i) byte((uint8) (v >> (8 * i)));
+        }
+
+        void qword(uint64 v) {
+            for (uint32 i = 0; i < 8; ++i) byte((uint8) (v >> (8 * i)));
+        }
+
+        /// Emit a REX prefix if any of its bits are needed
+        void rex(bool wide, uint8 reg, uint8 index, uint8 base) {
+            auto prefix = (uint8) (0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3));
+            if (prefix != 0x40) byte(prefix);
+        }
+
+        void modrm(uint8 mod, uint8 reg, uint8 rm) { byte((uint8) ((mod << 6) | ((reg & 7) << 3) | (rm & 7))); }
+
+        /// `op dst, src` for an "op r/m32, r32" opcode
+        void rr(uint8 op, uint8 dst, uint8 src) {
+            rex(false, src, 0, dst);
+            byte(op);
+            modrm(3, src, dst);
+        }
+
+        /// `op dst, imm32` for an opcode extension of the 0x81 group
+        void ri(uint8 ext, uint8 dst, uint32 imm) {
+            rex(false, 0, 0, dst);
+            byte(0x81);
+            modrm(3, ext, dst);
+            dword(imm);
+        }
+
+        /// `mov dst, imm32`
+        void mov_ri(uint8 dst, uint32 imm) {
+            rex(false, 0, 0, dst);
+            byte(0xb8 + (dst & 7));
+            dword(imm);
+        }
+
+        /// `mov dst, [base + disp]` (base must not be rsp or r12)
+        void load(uint8 dst, uint8 base, uint32 disp) {
+            rex(false, dst, 0, base);
+            byte(0x8b);
+            modrm(2, dst, base);
+            dword(disp);
+        }
+
+        /// `mov [base + disp], src` (base must not be rsp or r12)
+        void store(uint8 base, uint32 disp, uint8 src) {
+            rex(false, src, 0, base);
+            byte(0x89);
+            modrm(2, src, base);
+            dword(disp);
+        }
+
+        /// `add qword [base + disp], imm32` (sign extended; base must not be rsp or r12)
+        void add_mem64(uint8 base, uint32 disp, uint32 imm) {
+            rex(true, 0, 0, base);
+            byte(0x81);
+            modrm(2, 0, base);
+            dword(disp);
+            dword(imm);
+        }
+
+        /// `mov dst, [base + index]` (base must not be rbp or r13)
+        void load_indexed(uint8 dst, uint8 base, uint8 index) {
+            rex(false, dst, index, base);
+            byte(0x8b);
+            modrm(0, dst, 4);
+            byte((uint8) (((index & 7) << 3) | (base & 7)));
+        }
+
+        /// `setcc dst` followed by `movzx dst, dst` (dst must be one of rax, rcx, rdx, rbx)
+        void setcc(uint8 cc, uint8 dst) {
+            byte(0x0f);
+            byte(0x90 | cc);
+            modrm(3, 0, dst);
+            byte(0x0f);
+            byte(0xb6);
+            modrm(3, dst, dst);
+        }
+
+        /// Conditional jump with a 32 bit displacement, returns the position of the displacement for `patch`
+        size_t jcc(uint8 cc) {
+            byte(0x0f);
+            byte(0x80 | cc);
+            dword(0);
+            return pos() - 4;
+        }
+
+        /// Jump with a 32 bit displacement, returns the position of the displacement for `patch`
+        size_t jmp() {
+            byte(0xe9);
+            dword(0);
+            return pos() - 4;
+        }
+
+        /// Point the jump with the displacement at `at` to `target`
+        void patch(size_t at, size_t target) {
+            auto rel = (int32) (target - (at + 4));
+            memcpy(code.data() + at, &rel, 4);
+        }
+
+        /// `push reg` (64 bit)
+        void push(uint8 reg) {
+            rex(false, 0, 0, reg);
+            byte(0x50 + (reg & 7));
+        }
+
+        /// `pop reg` (64 bit)
+        void pop(uint8 reg) {
+            rex(false, 0, 0, reg);
+            byte(0x58 + (reg & 7));
+        }
+
+        /// `mov dst, src` (64 bit)
+        void mov_rr64(uint8 dst, uint8 src) {
+            rex(true, src, 0, dst);
+            byte(0x89);
+            modrm(3, src, dst);
+        }
+
+        /// `mov dst, imm64`
+        void mov_ri64(uint8 dst, uint64 imm) {
+            rex(true, 0, 0, dst);
+            byte(0xb8 + (dst & 7));
+            qword(imm);
+        }
+
+        /// Call an absolute address through rax
+        void call(const void* function) {
+            mov_ri64(RAX, (uint64) function);
+            byte(0xff);
+            modrm(3, 2, RAX);
+        }
+
+        /// `add rsp, imm8` / `sub rsp, imm8`
+        void adjust_rsp(bool add, uint8 imm) {
+            byte(0x48);
+            byte(0x83);
+            modrm(3, add ? 0 : 5, 4);
+            byte(imm);
+        }
+
+        void ret() { byte(0xc3); }
+    };
+
+    /// Write the tx8 registers held in host registers back into the cpu register array
+    static void store_registers(Emitter& e) {
+        for (uint32 id = 0; id < REGISTER_COUNT; ++id)
+            if (host_regs[id] != NO_HOST_REG) e.store(R15, id * 4, host_regs[id]);
+    }
+
+    /// Load the tx8 registers held in host registers from the cpu register array
+    static void load_registers(Emitter& e) {
+        for (uint32 id = 0; id < REGISTER_COUNT; ++id)
+            if (host_regs[id] != NO_HOST_REG) e.load(host_regs[id], R15, id * 4);
+    }
+
+    /// Get the host register of the full size register other than p a parameter names, whatever its mode (NO_HOST_REG
+    /// if there is none)
+    static uint8 named_host_reg(const Parameter& param) {
+        if ((param.value.u & REG_SIZE_MASK) != REG_SIZE_4) return NO_HOST_REG;
+        uint32 id = param.value.u & REG_ID_MASK;
+        return id < REGISTER_COUNT ? host_regs[id] : NO_HOST_REG;
+    }
+
+    /// Get the host register of a full size register parameter other than p (NO_HOST_REG if there is none)
+    static uint8 host_reg(const Parameter& param) {
+        return param.mode == ParamMode::Register ? named_host_reg(param) : NO_HOST_REG;
+    }
+
+    /// Set R to the unsigned (bit 0) and signed (bit 1) overflow flags of the previous addition or subtraction
+    static void emit_overflow_flags(Emitter& e) {
+        e.setcc(CC_B, RCX);
+        e.setcc(CC_O, RDX);
+        e.rr(OP_ADD, RDX, RDX);
+        e.rr(OP_OR, RCX, RDX);
+        e.rr(OP_MOV, HOST_R, RCX);
+    }
+
+    /// Set R to -1, 0 or 1 depending on the previous comparison
+    static void emit_compare_result(Emitter& e, bool is_signed) {
+        e.setcc(is_signed ? CC_G : CC_A, RCX);
+        e.setcc(is_signed ? CC_L : CC_B, RDX);
+        e.rr(OP_SUB, RCX, RDX);
+        e.rr(OP_MOV, HOST_R, RCX);
+    }
+
+    Jit::Jit(CPU& cpu, uint32 threshold) : cpu(cpu), threshold(threshold), code_pages(DECODE_PAGE_COUNT) {
+        void* mapping = mmap(nullptr, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) (*cpu.sinks.err)("[jit] Could not allocate the code buffer, running interpreted only\n");
+        else buffer = (uint8*) mapping;
+    }
+
+    Jit::~Jit() {
+        if (buffer != nullptr) munmap(buffer, JIT_BUFFER_SIZE);
+    }
+
+    bool Jit::enter() {
+        // compiled blocks do not log the instructions they execute
+        if (cpu.sinks.debug->is_enabled()) return false;
+
+        Entry& entry = entries[cpu.p];
+        if (entry.code == nullptr) {
+            if (entry.failed || ++entry.count < threshold) return false;
+
+            if (!compile(cpu.p, entry)) {
+                // the code buffer is full: start over, compiling blocks again once they are hot (`entry` is gone)
+                flush();
+                return false;
+            }
+            if (entry.code == nullptr) return false;
+        }
+
+        // compiled blocks keep R in a host register and compute it right away
+        cpu.materialize_r();
+        JitBlock code = entry.code;
+        code(cpu.registers.data(), cpu.mem.data(), &cpu);
+        return true;
+    }
+
+    void Jit::invalidate(mem_addr first, mem_addr last) {
+        bool has_code = false;
+        for (uint32 page = first >> DECODE_PAGE_BITS; page <= last >> DECODE_PAGE_BITS && !has_code; ++page)
+            has_code = code_pages[page];
+        if (!has_code) return;
+
+        for (auto it = entries.begin(); it != entries.end();) {
+            const auto& [start, entry] = *it;
+            if ((entry.code != nullptr || entry.failed) && start <= last && first < entry.end) {
+                it = entries.erase(it);
+                ++generation;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void Jit::invalidate_all() {
+        entries.clear();
+        ++generation;
+    }
+
+    void Jit::flush() {
+        calls.clear();
+        entries.clear();
+        code_pages.assign(DECODE_PAGE_COUNT, false);
+        used = 0;
+        ++generation;
+    }
+
+    JitBlock Jit::install(const std::vector<uint8>& code) {
+        if (buffer == nullptr || code.size() > JIT_BUFFER_SIZE - used) return nullptr;
+
+        mprotect(buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE);
+        memcpy(buffer + used, code.data(), code.size());
+        mprotect(buffer, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+
+        auto* block = (JitBlock) (buffer + used);
+        used += code.size();
+        return block;
+    }
+
+    bool Jit::compile(mem_addr start, Entry& entry) {
+        Emitter e;
+        // jumps leaving the block with p set to the given address, after executing the given number of instructions
+        // since the count was last updated
+        std::vector<std::tuple<size_t, mem_addr, uint32>> exits;
+        // jumps back to the start of the block, with the number of instructions executed since the count was updated
+        std::vector<std::pair<size_t, uint32>> back_edges;
+        // jumps leaving the block after a call back into the cpu, which already set p
+        std::vector<size_t> returns;
+        size_t              first_call = calls.size();
+
+        // prologue: save callee-saved registers (keeping the stack 16 byte aligned) and load the tx8 registers
+        for (uint8 reg : {RBX, RBP, R12, R13, R14, R15}) e.push(reg);
+        e.adjust_rsp(false, 8);
+        e.mov_rr64(R15, RDI);
+        e.mov_rr64(R14, RSI);
+        e.mov_rr64(RBP, RDX);
+        load_registers(e);
+        size_t loop_head = e.pos();
+
+        // instructions are counted exactly in `stats.compiled` (the time base of scheduled interrupts): the number of
+        // instructions executed since the last update is added through the cpu pointer in rbp before calling back into
+        // the cpu, leaving the block and looping
+        auto   compiled_disp = (uint32) ((uint8*) &cpu.stats.compiled - (uint8*) &cpu);
+        uint32 pending       = 0;
+        auto   count         = [&](uint32 executed) {
+            if (executed > 0) e.add_mem64(RBP, compiled_disp, executed);
+        };
+
+        // jump to the start of the block or leave it towards `target`; while interrupts may be handled, blocks always
+        // return to the run loop, which handles them at block boundaries
+        bool loops   = cpu.next_event == CPU::NO_EVENT;
+        auto jump_to = [&](size_t at, mem_addr target) {
+            if (target == start && loops) back_edges.emplace_back(at, pending);
+            else exits.emplace_back(at, target, pending);
+        };
+
+        // load the value of a source parameter into a host register or a constant, calling back into the cpu for
+        // memory outside the fast path; returns false if the parameter cannot be compiled
+        auto source = [&](const Parameter& param, mem_addr addr, bool sign_extended, uint8& reg, uint32& constant) {
+            reg = NO_HOST_REG;
+            switch (param.mode) {
+                case ParamMode::Constant8:
+                    constant = sign_extended ? (int32) (int8) param.value.u : param.value.u;
+                    return true;
+                case ParamMode::Constant16:
+                    constant = sign_extended ? (int32) (int16) param.value.u : param.value.u;
+                    return true;
+                case ParamMode::Constant32: constant = param.value.u; return true;
+                case ParamMode::Register:
+                    if (param.value.u == (uint32) Register::P) {
+                        constant = addr;
+                        return true;
+                    }
+                    reg = host_reg(param);
+                    return reg != NO_HOST_REG;
+                case ParamMode::AbsoluteAddress:
+                    if (param.value.u <= MEM_SIZE - 4 && cpu.mem_direct(param.value.u, 4)) {
+                        e.load(RAX, R14, param.value.u);
+                        reg = RAX;
+                        return true;
+                    }
+                    e.mov_ri(RAX, param.value.u);
+                    break;
+                case ParamMode::RelativeAddress:
+                    e.rr(OP_MOV, RAX, HOST_O);
+                    e.ri(0, RAX, param.value.u);
+                    break;
+                case ParamMode::RegisterAddress:
+                    if (param.value.u == (uint32) Register::P) e.mov_ri(RAX, addr);
+                    else if (named_host_reg(param) != NO_HOST_REG) e.rr(OP_MOV, RAX, named_host_reg(param));
+                    else return false;
+                    break;
+                default: return false;
+            }
+
+            // memory word at the address in rax: read directly unless it touches the end of the memory or devices are
+            // mapped (mapping a device discards all compiled code)
+            bool   direct = cpu.devices.empty();
+            size_t done   = 0;
+            if (direct) {
+                e.ri(7, RAX, MEM_SIZE - 4);
+                size_t slow = e.jcc(CC_A);
+                e.load_indexed(RAX, R14, RAX);
+                done = e.jmp();
+                e.patch(slow, e.pos());
+            }
+            store_registers(e);
+            e.rr(OP_MOV, RSI, RAX);
+            e.mov_rr64(RDI, RBP);
+            e.call((const void*) &Jit::read);
+            load_registers(e);
+            if (direct) e.patch(done, e.pos());
+            reg = RAX;
+            return true;
+        };
+
+        // compile an instruction to native code; returns false if it has to be executed by the cpu
+        auto native = [&](const Instruction& inst, mem_addr addr) {
+            const auto& [p1, p2] = inst.params;
+            Opcode op            = inst.opcode;
+
+            uint8            dst = host_reg(p1);
+            const Parameter* src = &p2;
+            switch (op) {
+                case Opcode::Lda:
+                case Opcode::Ldb:
+                case Opcode::Ldc:
+                case Opcode::Ldd:
+                    dst = host_regs[((uint32) op - (uint32) Opcode::Lda) / 2];
+                    src = &p1;
+                    op  = Opcode::Ld;
+                    break;
+                case Opcode::Ld:
+                case Opcode::Lds:
+                case Opcode::Add:
+                case Opcode::Sub:
+                case Opcode::Uadd:
+                case Opcode::Usub:
+                case Opcode::And:
+                case Opcode::Or:
+                case Opcode::Xor:
+                case Opcode::Cmp:
+                case Opcode::Ucmp:
+                case Opcode::Inc:
+                case Opcode::Dec:
+                case Opcode::Zero: break;
+                default: return false;
+            }
+            if (dst == NO_HOST_REG) return false;
+
+            if (op == Opcode::Zero || op == Opcode::Inc || op == Opcode::Dec) {
+                if (op == Opcode::Zero) {
+                    e.mov_ri(dst, 0);
+                } else {
+                    // the overflow flags of inc / dec are the ones of adding / subtracting 1
+                    e.ri(op == Opcode::Inc ? 0 : 5, dst, 1);
+                    emit_overflow_flags(e);
+                }
+                return true;
+            }
+
+            bool   is_signed = op == Opcode::Add || op == Opcode::Sub || op == Opcode::Cmp || op == Opcode::Lds;
+            uint8  reg;
+            uint32 constant;
+            if (!source(*src, addr, is_signed, reg, constant)) return false;
+
+            // "op r/m32, r32" opcode and 0x81 group extension of the operation
+            uint8 rr_op;
+            uint8 ri_ext;
+            switch (op) {
+                case Opcode::Ld:
+                case Opcode::Lds:
+                    if (reg == NO_HOST_REG) e.mov_ri(dst, constant);
+                    else e.rr(OP_MOV, dst, reg);
+                    return true;
+                case Opcode::Add:
+                case Opcode::Uadd: rr_op = OP_ADD, ri_ext = 0; break;
+                case Opcode::Sub:
+                case Opcode::Usub: rr_op = OP_SUB, ri_ext = 5; break;
+                case Opcode::And: rr_op = OP_AND, ri_ext = 4; break;
+                case Opcode::Or: rr_op = OP_OR, ri_ext = 1; break;
+                case Opcode::Xor: rr_op = OP_XOR, ri_ext = 6; break;
+                default: rr_op = OP_CMP, ri_ext = 7; break;
+            }
+
+            if (reg == NO_HOST_REG) e.ri(ri_ext, dst, constant);
+            else e.rr(rr_op, dst, reg);
+
+            if (op == Opcode::Cmp || op == Opcode::Ucmp) emit_compare_result(e, op == Opcode::Cmp);
+            else if (rr_op == OP_ADD || rr_op == OP_SUB) emit_overflow_flags(e);
+            return true;
+        };
+
+        mem_addr addr          = start;
+        uint32   length        = 0;
+        uint32   native_length = 0;
+        bool     open          = true; // if the end of the compiled code continues with the next instruction
+        while (length < JIT_MAX_BLOCK_LENGTH && addr <= MEM_SIZE - INSTRUCTION_MAX_LENGTH - 1) {
+            // decode through the cpu cache, so writes to the compiled code reach `invalidate`
+            const DecodedInstruction& decoded = cpu.decode_slot(addr);
+            const Instruction&        inst    = decoded.inst;
+            const Parameter&          p1      = inst.params.p1;
+            mem_addr                  next    = addr + inst.len;
+            ++length;
+            ++pending;
+
+            bool constant_target = p1.mode >= ParamMode::Constant8 && p1.mode <= ParamMode::Constant32;
+            if (inst.opcode >= Opcode::Jmp && inst.opcode <= Opcode::Jle && constant_target) {
+                ++native_length;
+                mem_addr target = p1.value.u;
+                // a jump to itself continues with the next instruction
+                if (target == addr) {
+                    addr = next;
+                    continue;
+                }
+                addr = next;
+
+                if (inst.opcode == Opcode::Jmp) {
+                    jump_to(e.jmp(), target);
+                    open = false;
+                    break;
+                }
+
+                static constexpr std::array<uint8, 6> conditions = {CC_E, CC_NE, CC_G, CC_GE, CC_L, CC_LE};
+                e.rr(OP_TEST, HOST_R, HOST_R);
+                jump_to(e.jcc(conditions[(uint32) inst.opcode - (uint32) Opcode::Jeq]), target);
+                continue;
+            }
+
+            if (native(inst, addr)) {
+                ++native_length;
+                addr = next;
+                continue;
+            }
+
+            calls.push_back({inst, decoded.handler, addr});
+            // the instruction counts once the cpu executes it, like in the run loop
+            count(pending);
+            pending = 0;
+            store_registers(e);
+            e.mov_rr64(RDI, RBP);
+            e.mov_ri64(RSI, (uint64) &calls.back());
+            e.call((const void*) &Jit::exec);
+            load_registers(e);
+            e.rr(OP_TEST, RAX, RAX);
+            returns.push_back(e.jcc(CC_NE));
+            addr = next;
+
+            // the cpu already left the block if the instruction changed p
+            if (op_changes_p(inst.opcode) || inst.opcode == Opcode::Hlt || inst.opcode == Opcode::Stop) {
+                open = false;
+                break;
+            }
+        }
+        entry.end = addr;
+
+        if (native_length == 0) {
+            // nothing to gain over the interpreter
+            calls.resize(first_call);
+            entry.failed = true;
+            return true;
+        }
+
+        // exits: store p and the registers, then return
+        if (open) exits.emplace_back(e.jmp(), addr, pending);
+        for (const auto& [at, executed] : back_edges) {
+            e.patch(at, e.pos());
+            count(executed);
+            e.patch(e.jmp(), loop_head);
+        }
+        std::vector<size_t> stubs;
+        for (const auto& [at, target, executed] : exits) {
+            e.patch(at, e.pos());
+            count(executed);
+            e.mov_ri(RAX, target);
+            stubs.push_back(e.jmp());
+        }
+        size_t store_tail = e.pos();
+        for (size_t at : stubs) e.patch(at, store_tail);
+        e.store(R15, (uint32) Register::P * 4, RAX);
+        store_registers(e);
+
+        size_t return_tail = e.pos();
+        for (size_t at : returns) e.patch(at, return_tail);
+        e.adjust_rsp(true, 8);
+        for (uint8 reg : {R15, R14, R13, R12, RBP, RBX}) e.pop(reg);
+        e.ret();
+
+        entry.code = install(e.code);
+        if (entry.code == nullptr) {
+            // without a code buffer nothing can be compiled; otherwise it is full and has to be flushed
+            entry.failed = buffer == nullptr;
+            return entry.failed;
+        }
+
+        ++compiled;
+        for (uint32 page = start >> DECODE_PAGE_BITS; page <= (addr - 1) >> DECODE_PAGE_BITS; ++page)
+            code_pages[page] = true;
+        // writes to the block have to reach `invalidate` even if the cpu did not decode its instructions itself
+        cpu.mark_code(start, addr - 1);
+        return true;
+    }
+
+    uint32 Jit::exec(CPU* cpu, const JitCall* call) {
+        uint32 generation = cpu->jit->generation;
+
+        cpu->p = call->addr;
+        (cpu->*call->handler)(call->inst.params);
+        cpu->materialize_r();
+
+        bool jumped = cpu->p != call->addr;
+        if (!jumped && !cpu->halted && !cpu->stopped && cpu->jit->generation == generation) return 0;
+
+        // leave the block like the run loop would continue
+        if (!jumped) cpu->p += call->inst.len;
+        return 1;
+    }
+
+    uint32 Jit::read(CPU* cpu, mem_addr location) { return cpu->mem_read(location); }
+} // namespace tx
+
+#else
+
+namespace tx {
+    // only needed to destroy the (always null) JIT of a cpu
+    Jit::~Jit() = default;
+} // namespace tx
+
+#endif
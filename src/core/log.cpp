@@ -1,6 +1,134 @@
 #include "tx8/core/log.hpp"
 
+#include "tx8/core/types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace tx {
+    /// Writer thread of an asynchronous logger, fed through a ring of bytes with a single producer (the logging
+    /// thread) and a single consumer (the writer thread)
+    class Log::AsyncWriter {
+      public:
+        AsyncWriter(Log& log, size_t capacity, LogOverflow overflow)
+            : log(log), ring(std::bit_ceil(std::max(capacity, (size_t) 1))), overflow(overflow) {
+            thread = std::thread([this]() { drain(); });
+        }
+
+        /// Write everything that was pushed, then stop the writer thread
+        ~AsyncWriter() {
+            stopping.store(true, std::memory_order_release);
+            wake();
+            thread.join();
+        }
+
+        AsyncWriter(const AsyncWriter&)            = delete;
+        AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+        /// Hand bytes to the writer thread, applying the overflow policy if they do not fit into the ring
+        void push(const char* data, size_t size) {
+            if (overflow == LogOverflow::Drop && size > space()) {
+                dropped.fetch_add(size, std::memory_order_relaxed);
+                return;
+            }
+
+            while (size > 0) {
+                size_t t = tail.load(std::memory_order_acquire);
+                size_t h = head.load(std::memory_order_relaxed);
+                size_t n = std::min(size, ring.size() - (h - t));
+                if (n == 0) {
+                    // the writer thread notifies after every write, so this waits for I/O only when the ring is full
+                    tail.wait(t, std::memory_order_acquire);
+                    continue;
+                }
+
+                size_t at    = h & (ring.size() - 1);
+                size_t first = std::min(n, ring.size() - at);
+                memcpy(ring.data() + at, data, first);
+                memcpy(ring.data(), data + first, n - first);
+                head.store(h + n, std::memory_order_release);
+                wake();
+
+                data += n;
+                size -= n;
+            }
+        }
+
+        /// Wait until the writer thread has written everything that was pushed
+        void sync() {
+            for (;;) {
+                size_t t = tail.load(std::memory_order_acquire);
+                if (t == head.load(std::memory_order_relaxed)) return;
+                tail.wait(t, std::memory_order_acquire);
+            }
+        }
+
+        std::atomic<size_t> dropped = 0;
+
+      private:
+        /// Free bytes in the ring
+        inline size_t space() const {
+            return ring.size() - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+        }
+
+        /// Wake the writer thread
+        inline void wake() {
+            wakeups.fetch_add(1, std::memory_order_release);
+            wakeups.notify_one();
+        }
+
+        /// Writer thread: write pushed bytes until stopped
+        void drain() {
+            for (;;) {
+                // read before checking for work, so a push after the check changes it and the wait returns
+                uint32 seen = wakeups.load(std::memory_order_acquire);
+                size_t t    = tail.load(std::memory_order_relaxed);
+                size_t h    = head.load(std::memory_order_acquire);
+                if (h == t) {
+                    // bytes pushed right before stopping may not have been visible when reading `head` above
+                    if (stopping.load(std::memory_order_acquire)) {
+                        if (head.load(std::memory_order_acquire) == t) return;
+                        continue;
+                    }
+                    wakeups.wait(seen, std::memory_order_acquire);
+                    continue;
+                }
+
+                // the pushed bytes wrap around at most once
+                size_t at    = t & (ring.size() - 1);
+                size_t first = std::min(h - t, ring.size() - at);
+                write(ring.data() + at, first);
+                if (h - t > first) write(ring.data(), h - t - first);
+
+                tail.store(h, std::memory_order_release);
+                tail.notify_all();
+            }
+        }
+
+        /// Write to the sinks of the logger
+        void write(const char* data, size_t size) {
+            log.write(data, size);
+            if (log.func != nullptr) log.func(std::string(data, size));
+        }
+
+        Log&                log;
+        std::vector<char>   ring;
+        LogOverflow         overflow;
+        std::atomic<size_t> head     = 0;
+        std::atomic<size_t> tail     = 0;
+        std::atomic<uint32> wakeups  = 0;
+        std::atomic<bool>   stopping = false;
+        std::thread         thread;
+    };
+} // namespace tx
+
 void tx::Log::reset() {
+    flush();
+    async.reset();
     stream = nullptr;
     file   = nullptr;
     delete str;
@@ -9,9 +137,36 @@ void tx::Log::reset() {
     enabled = false;
 }
 
+void tx::Log::flush() {
+    if (buffer.size() == 0) return;
+    if (async != nullptr) async->push(buffer.data(), buffer.size());
+    else write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void tx::Log::write(const char* data, size_t size) {
+    if (stream != nullptr) stream->write(data, (std::streamsize) size);
+    if (file != nullptr) fwrite(data, 1, size, file);
+}
+
+void tx::Log::init_async(size_t capacity, LogOverflow overflow) {
+    flush();
+    async.reset();
+    async = std::make_unique<AsyncWriter>(*this, capacity, overflow);
+}
+
+void tx::Log::sync() {
+    flush();
+    if (async != nullptr) async->sync();
+}
+
+size_t tx::Log::dropped() const { return async != nullptr ? async->dropped.load(std::memory_order_relaxed) : 0; }
+
 tx::Log::Log() { reset(); }
 
 tx::Log::~Log() {
+    flush();
+    async.reset();
     delete str;
     str = nullptr;
 }
@@ -0,0 +1,203 @@
+#include "tx8/core/memory.hpp"
+
+#include "tx8/core/types.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TX8_MEMORY_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(TX8_MEMORY_MMAP) && defined(MFD_CLOEXEC)
+#define TX8_MEMORY_MEMFD
+#endif
+
+#if defined(TX8_MEMORY_MMAP) && defined(MADV_HUGEPAGE) && !defined(TX8_NO_HUGE_PAGES)
+#define TX8_MEMORY_HUGE_PAGES
+#endif
+
+namespace tx {
+    /// Size of a (transparent) huge page
+    const size_t HUGE_PAGE_SIZE = 0x200000;
+
+    /// Round a value up to a multiple of `alignment` (a power of two)
+    static inline size_t align_up(size_t value, size_t alignment) { return (value + alignment - 1) & ~(alignment - 1); }
+
+#ifdef TX8_MEMORY_MMAP
+    /// Size of a regular page
+    static inline size_t page_size() { return (size_t) sysconf(_SC_PAGESIZE); }
+#endif
+
+    SharedRom::SharedRom(std::span<const uint8> rom) : length(rom.size()) {
+#ifdef TX8_MEMORY_MEMFD
+        fd = memfd_create("tx8-rom", MFD_CLOEXEC);
+        bool ok = fd >= 0 && ftruncate(fd, (off_t) length) == 0;
+        for (size_t written = 0; ok && written < length;) {
+            ssize_t n = write(fd, rom.data() + written, length - written);
+            ok        = n > 0;
+            written += ok ? (size_t) n : 0;
+        }
+
+        void* area = (ok && length > 0) ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (area != MAP_FAILED) {
+            view = (const uint8*) area;
+            return;
+        }
+        if (fd >= 0) close(fd);
+        fd = -1;
+#endif
+        fallback.assign(rom.begin(), rom.end());
+        view = fallback.data();
+    }
+
+    SharedRom::~SharedRom() {
+#ifdef TX8_MEMORY_MEMFD
+        if (fd < 0) return;
+        munmap((void*) view, length);
+        close(fd);
+#endif
+    }
+
+    Memory::Memory(size_t size) : length(size) { allocate(0); }
+
+    Memory::Memory(size_t size, size_t offset, const std::string& path, size_t file_offset, size_t count)
+        : length(size) {
+        count = std::min(count, size - offset);
+#ifdef TX8_MEMORY_MMAP
+        // file offsets and addresses have to agree modulo the page size to be mapped
+        allocate((file_offset - offset) & (page_size() - 1));
+        if (map_file(offset, path, file_offset, count)) return;
+#else
+        allocate(0);
+#endif
+
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        file.seekg((std::streamoff) file_offset);
+        file.read((char*) ptr + offset, (std::streamsize) count);
+    }
+
+    Memory::Memory(size_t size, size_t offset, const SharedRom& rom) : length(size) {
+        size_t count = std::min(rom.size(), size - offset);
+#ifdef TX8_MEMORY_MMAP
+        allocate((0 - offset) & (page_size() - 1));
+        if (rom.fd >= 0 && map_fd(offset, rom.fd, 0, count)) return;
+#else
+        allocate(0);
+#endif
+        std::copy_n(rom.data().begin(), count, ptr + offset);
+    }
+
+    Memory::~Memory() { release(); }
+
+    Memory::Memory(Memory&& other) noexcept
+        : ptr(std::exchange(other.ptr, nullptr)), length(std::exchange(other.length, 0)),
+          mapping(std::exchange(other.mapping, nullptr)), mapped(std::exchange(other.mapped, 0)) { }
+
+    Memory& Memory::operator=(Memory&& other) noexcept {
+        if (this != &other) {
+            release();
+            ptr     = std::exchange(other.ptr, nullptr);
+            length  = std::exchange(other.length, 0);
+            mapping = std::exchange(other.mapping, nullptr);
+            mapped  = std::exchange(other.mapped, 0);
+        }
+        return *this;
+    }
+
+    void Memory::use_huge_pages(size_t offset, size_t size) {
+#ifdef TX8_MEMORY_HUGE_PAGES
+        size_t first = align_up(offset, HUGE_PAGE_SIZE);
+        size_t last  = (offset + size) & ~(HUGE_PAGE_SIZE - 1);
+        // only a hint, the kernel silently falls back to normal pages (also if `ptr` is not aligned)
+        if (first < last) madvise(ptr + first, last - first, MADV_HUGEPAGE);
+#endif
+    }
+
+    void Memory::allocate(size_t shift) {
+#ifdef TX8_MEMORY_MMAP
+        mapped = align_up(length + shift, page_size());
+#ifdef TX8_MEMORY_HUGE_PAGES
+        // reserve enough to align the start to a huge page, as only aligned huge pages can be used
+        mapped += HUGE_PAGE_SIZE;
+#endif
+
+        void* area = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED) throw std::bad_alloc();
+        mapping = (uint8*) area;
+#ifdef TX8_MEMORY_HUGE_PAGES
+        ptr = (uint8*) align_up((size_t) mapping, HUGE_PAGE_SIZE) + shift;
+#else
+        ptr = mapping + shift;
+#endif
+#else
+        (void) shift;
+        ptr = (uint8*) calloc(length, 1);
+        if (ptr == nullptr) throw std::bad_alloc();
+        mapping = ptr;
+#endif
+    }
+
+    bool Memory::map_file(size_t offset, const std::string& path, size_t file_offset, size_t count) {
+#ifdef TX8_MEMORY_MMAP
+        if (count == 0) return true;
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        // touching a mapped page past the end of the file would raise SIGBUS
+        struct stat st {};
+        bool        ok = fstat(fd, &st) == 0 && (size_t) st.st_size >= file_offset + count;
+        ok             = ok && map_fd(offset, fd, file_offset, count);
+        close(fd);
+        return ok;
+#else
+        (void) offset, (void) path, (void) file_offset, (void) count;
+        return false;
+#endif
+    }
+
+    bool Memory::map_fd(size_t offset, int fd, size_t file_offset, size_t count) {
+#ifdef TX8_MEMORY_MMAP
+        if (count == 0) return true;
+
+        size_t lead  = file_offset & (page_size() - 1);
+        uint8* start = ptr + offset - lead;
+        size_t len   = align_up(lead + count, page_size());
+        if (mmap(start, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t) (file_offset - lead))
+            == MAP_FAILED) {
+            // make sure the range is zeroed anonymous memory again
+            mmap(start, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            return false;
+        }
+
+        // the first and last page may contain parts of the file outside the region, which have to read as zero
+        uint8* end = ptr + offset + count;
+        memset(start, 0, lead);
+        memset(end, 0, start + len - end);
+        return true;
+#else
+        (void) offset, (void) fd, (void) file_offset, (void) count;
+        return false;
+#endif
+    }
+
+    void Memory::release() {
+        if (mapping == nullptr) return;
+#ifdef TX8_MEMORY_MMAP
+        munmap(mapping, mapped);
+#else
+        free(mapping);
+#endif
+        mapping = nullptr;
+        ptr     = nullptr;
+    }
+} // namespace tx
@@ -4,6 +4,10 @@
 #include "tx8/core/instruction.hpp"
 #include "tx8/core/log.hpp"
 
+#include <cstring>
+#include <string>
+#include <string_view>
+
 #define f(name) void name(CPU& cpu)
 
 #pragma clang diagnostic ignored "-Wunused-parameter"
@@ -12,47 +16,144 @@ namespace tx::stdlib {
     /// `print_u32(uint32 n)` - logs `n`
     f(print_u32) {
         uint32 val = cpu.top();
-        tx::log("{}", val);
+        (*cpu.sinks.out)("{}", val);
     }
 
     /// `print_i32(int32 n)` - logs `n` as a signed value
     f(print_i32) {
         num32 val;
         val.u = cpu.top();
-        tx::log("{}", val.i);
+        (*cpu.sinks.out)("{}", val.i);
     }
 
     f(print_f32) {
         num32 val;
         val.u = cpu.top();
-        tx::log("{}", val.f);
+        (*cpu.sinks.out)("{}", val.f);
+    }
+
+    /// Get the zero terminated string at `location` (the out of bounds byte at the end of the memory terminates every
+    /// string); `buffer` holds its characters if they have to be read through the memory bus
+    static std::string_view string_at(CPU& cpu, mem_addr location, std::string& buffer) {
+        location &= MEM_SIZE;
+        const auto* str = (const char*) cpu.mem.data() + location;
+        if (cpu.mem_direct(location, MEM_SIZE - location)) return {str, strnlen(str, MEM_SIZE - location)};
+
+        for (mem_addr addr = location; addr < MEM_SIZE; ++addr) {
+            auto c = (char) cpu.mem_read<ValueSize::Byte>(addr);
+            if (c == 0) break;
+            buffer += c;
+        }
+        return buffer;
     }
 
     /// `print(char* s)` - logs the zero terminated string at `s`
     f(print) {
-        uint32 addr = cpu.top();
-        tx::log("{}", (char*) (cpu.mem.data() + addr));
+        std::string buffer;
+        (*cpu.sinks.out)("{}", string_at(cpu, cpu.top(), buffer));
     }
 
     /// `println(char* s)` - Prints the zero terminated string at `s` with a trailing newline
     f(println) {
-        uint32 addr = cpu.top();
-        char*  str  = (char*) (cpu.mem.data() + addr);
-        tx::log("{}\n", str);
+        std::string buffer;
+        (*cpu.sinks.out)("{}\n", string_at(cpu, cpu.top(), buffer));
     }
 
     /// `put(char c)` - Prints the character `c`
     f(put) {
         char c = (char) cpu.top();
-        tx::log("{}", c);
+        (*cpu.sinks.out)("{}", c);
     }
 
     /// `get()` - Reads a character from stdin and pushes it to the stack
     f(get) {
+        // a prompt printed before must be visible while waiting for input
+        cpu.sinks.out->flush();
         char c = (char) getc(stdin);
         cpu.push(c, tx::ValueSize::Byte);
     }
 
+    // The memory functions take their parameters like functions following the calling convention (the first parameter
+    // is the topmost value on the stack), push their result and treat memory like byte by byte accesses would (see
+    // `tx::mem_spans`), while running on the host's vectorized string functions.
+
+    /// Get the `index`th 32 bit parameter from the stack
+    static inline uint32 param(CPU& cpu, uint32 index) { return cpu.mem_read(cpu.s + index * 4); }
+
+    /// Read a byte like the `ld` instruction would (bytes out of bounds read as 0)
+    static inline uint8 byte_at(CPU& cpu, mem_addr location) {
+        return cpu.mem_read(location & MEM_SIZE, ValueSize::Byte);
+    }
+
+    /// Sign of the difference of two bytes
+    static inline int32 compare_bytes(uint8 a, uint8 b) { return (a > b) - (a < b); }
+
+    /// `memcpy(void* dst, void* src, uint32 n)` - copies `n` bytes from `src` to `dst`
+    f(memcpy) { cpu.mem_copy(param(cpu, 0), param(cpu, 1), param(cpu, 2)); }
+
+    /// `memmove(void* dst, void* src, uint32 n)` - copies `n` bytes from `src` to `dst`, the ranges may overlap
+    f(memmove) { cpu.mem_copy(param(cpu, 0), param(cpu, 1), param(cpu, 2)); }
+
+    /// `memset(void* dst, uint8 c, uint32 n)` - sets `n` bytes at `dst` to `c`
+    f(memset) { cpu.mem_set(param(cpu, 0), (uint8) param(cpu, 1), param(cpu, 2)); }
+
+    /// `memcmp(void* a, void* b, uint32 n) -> int32` - compares `n` bytes at `a` and `b`, pushes -1, 0 or 1
+    f(memcmp) {
+        mem_addr a = param(cpu, 0) & MEM_SIZE;
+        mem_addr b = param(cpu, 1) & MEM_SIZE;
+        uint32   n = MIN(param(cpu, 2), MEM_SIZE + 1);
+
+        int32 result = 0;
+        if (a + n <= MEM_SIZE && b + n <= MEM_SIZE && cpu.mem_direct(a, n) && cpu.mem_direct(b, n)) {
+            int diff = std::memcmp(cpu.mem.data() + a, cpu.mem.data() + b, n);
+            result   = (diff > 0) - (diff < 0);
+        } else {
+            for (uint32 i = 0; i < n && result == 0; ++i)
+                result = compare_bytes(byte_at(cpu, a + i), byte_at(cpu, b + i));
+        }
+        cpu.push(result);
+    }
+
+    /// `strlen(char* s) -> uint32` - pushes the length of the zero terminated string at `s`
+    f(strlen) {
+        std::string buffer;
+        cpu.push((uint32) string_at(cpu, param(cpu, 0), buffer).size());
+    }
+
+    /// `strcmp(char* a, char* b) -> int32` - compares the zero terminated strings at `a` and `b`, pushes -1, 0 or 1
+    f(strcmp) {
+        mem_addr a = param(cpu, 0) & MEM_SIZE;
+        mem_addr b = param(cpu, 1) & MEM_SIZE;
+        if (!cpu.mem_direct(a, MEM_SIZE - a) || !cpu.mem_direct(b, MEM_SIZE - b)) {
+            // the strings end at the latest at the end of the memory, so the comparison never wraps around
+            uint8 ca, cb;
+            for (mem_addr i = 0;; ++i) {
+                ca = byte_at(cpu, a + i);
+                cb = byte_at(cpu, b + i);
+                if (ca != cb || ca == 0) break;
+            }
+            cpu.push(compare_bytes(ca, cb));
+            return;
+        }
+
+        uint32      n  = MIN(MEM_SIZE - a, MEM_SIZE - b);
+        const char* sa = (const char*) cpu.mem.data() + a;
+        const char* sb = (const char*) cpu.mem.data() + b;
+
+        int   diff   = std::strncmp(sa, sb, n);
+        int32 result = (diff > 0) - (diff < 0);
+        // both strings continue up to the end of the memory, the byte after it terminates at least one of them
+        if (diff == 0 && strnlen(sa, n) == n) result = compare_bytes(byte_at(cpu, a + n), byte_at(cpu, b + n));
+        cpu.push(result);
+    }
+
+    /// `set_timer(uint32 n)` - raises the timer interrupt every `n` cycles, stops the timer if `n` is 0
+    f(set_timer) {
+        uint32 period = param(cpu, 0);
+        cpu.cancel_interrupt(INTERRUPT_TIMER);
+        if (period != 0) cpu.schedule_interrupt(INTERRUPT_TIMER, period, period);
+    }
+
 #pragma clang diagnostic warning "-Wunused-parameter"
 
 
@@ -66,6 +167,13 @@ namespace tx::stdlib {
         r(println);
         r(put);
         r(get);
+        r(memcpy);
+        r(memmove);
+        r(memset);
+        r(memcmp);
+        r(strlen);
+        r(strcmp);
+        r(set_timer);
     }
 
 } // namespace tx::stdlib
@@ -3,6 +3,7 @@
 #include "tx8/core/instruction.hpp"
 #include "tx8/core/log.hpp"
 
+#include <fstream>
 #include <istream>
 
 using namespace tx;
@@ -59,6 +60,21 @@ std::optional<RomInfo> tx::parse_header(std::istream& stream) {
     return info;
 }
 
+std::optional<RomFile> tx::open_rom_file(const std::string& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    auto          info = parse_header(file);
+    if (!info.has_value()) return std::nullopt;
+
+    size_t offset = BASIC_ROM_INFO_LEN + info.value().name.size() + info.value().description.size();
+    file.seekg(0, std::ios::end);
+    if ((size_t) file.tellg() < offset + info.value().size) {
+        tx::log_debug("[open_rom_file] File {} is too short for a rom of size {}\n", path, info.value().size);
+        return std::nullopt;
+    }
+
+    return RomFile {path, std::move(info.value()), offset};
+}
+
 std::vector<uint8> tx::build_header(const RomInfo& info) {
     std::vector<uint8> header(BASIC_ROM_INFO_LEN + info.name.size() + info.description.size(), 0);
 
@@ -82,23 +82,30 @@ void VMTest::run_and_compare_num(
 }
 
 bool VMTest::run_code(const std::string& s) {
-    tx::Assembler as(s);
-    auto          rom_ = as.generate_binary();
-    if (!rom_.has_value()) {
-        ADD_FAILURE() << "Assembler encountered an error:" << std::endl << tx::log_err.get_str();
-        return false;
-    }
+    auto cpu = make_cpu(s);
+    if (cpu == nullptr) return false;
 
-    auto rom = rom_.value();
+    if (jit_threshold > 0) cpu->enable_jit(jit_threshold);
+    cpu->run();
 
-    tx::CPU cpu(rom);
+    return true;
+}
 
-    tx::stdlib::use_stdlib(cpu);
-    use_testing_stdlib(cpu);
+std::optional<tx::Rom> VMTest::assemble(const std::string& code) {
+    tx::Assembler as(code);
+    auto          rom = as.generate_binary();
+    if (!rom.has_value()) ADD_FAILURE() << "Assembler encountered an error:" << std::endl << tx::log_err.get_str();
+    return rom;
+}
 
-    cpu.run();
+std::unique_ptr<tx::CPU> VMTest::make_cpu(const std::string& code, const tx::CpuSinks& sinks) {
+    auto rom = assemble(code);
+    if (!rom.has_value()) return nullptr;
 
-    return true;
+    auto cpu = std::make_unique<tx::CPU>(rom.value(), sinks);
+    tx::stdlib::use_stdlib(*cpu);
+    use_testing_stdlib(*cpu);
+    return cpu;
 }
 
 void VMTest::use_testing_stdlib(tx::CPU& cpu) {
@@ -6,6 +6,8 @@
 #include "tx8/core/stdlib.hpp"
 
 #include <gtest/gtest.h>
+#include <memory>
+#include <optional>
 #include <vector>
 
 class VMTest : public ::testing::Test { // NOLINT
@@ -14,6 +16,8 @@ class VMTest : public ::testing::Test { // NOLINT
 
   protected:
     std::vector<tx::num32_variant> nums;
+    /// JIT threshold of the cpus running the test code (0 to only interpret)
+    tx::uint32 jit_threshold = 0;
 
     VMTest();
     ~VMTest() override;
@@ -31,6 +35,11 @@ class VMTest : public ::testing::Test { // NOLINT
 
     bool run_code(const std::string& s);
 
+    /// Assemble `code`, failing the test if the assembler encountered an error
+    std::optional<tx::Rom> assemble(const std::string& code);
+    /// Assemble `code` into a cpu using the standard and testing sysfuncs (nullptr if the assembler failed)
+    std::unique_ptr<tx::CPU> make_cpu(const std::string& code, const tx::CpuSinks& sinks = {});
+
     void use_testing_stdlib(tx::CPU& cpu);
 };
 
@@ -41,3 +50,9 @@ class Unsigned : public VMTest { };
 class Miscellaneous : public VMTest { };
 class Integration : public VMTest { };
 class SmallRegisters : public VMTest { };
+class Jit : public VMTest {
+  protected:
+    Jit() { jit_threshold = 1; }
+};
+class Aot : public VMTest { };
+class Batch : public VMTest { };
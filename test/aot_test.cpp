@@ -0,0 +1,134 @@
+#include "VMTest.hpp"
+
+#include "tx8/core/aot.hpp"
+
+// Tests if recovery follows jumps and calls, but not into data behind the end of the code
+TEST_F(Aot, recover) {
+    std::string s = R"EOF(
+ld a 1
+jeq :skip
+call :func
+:skip
+hlt
+:func
+inc a
+ret
+:data
+"data"
+)EOF";
+    auto        rom = assemble(s);
+    ASSERT_TRUE(rom.has_value());
+
+    tx::aot::Translator translator(rom.value());
+    auto                code = translator.recover();
+    // ld a 1 (7 bytes), jeq (6), call (6), hlt (1), inc a (3), ret (1)
+    std::vector<tx::mem_addr> expected = {0x400000, 0x400007, 0x40000d, 0x400013, 0x400014, 0x400017};
+    EXPECT_EQ(code, expected);
+}
+
+// Tests the statements generated for native, jump and called instructions
+TEST_F(Aot, translate) {
+    std::string s = R"EOF(
+zero a
+:loop
+add a 2i8
+cmp a -4i8
+jne :loop
+sys &print_u32
+hlt
+)EOF";
+    auto        rom = assemble(s);
+    ASSERT_TRUE(rom.has_value());
+
+    tx::aot::Translator translator(rom.value());
+    std::string         out = translator.translate("loop.tx8");
+
+    EXPECT_NE(out.find("case 0x400000: goto L_400000;"), std::string::npos);
+    EXPECT_NE(out.find("cpu.a = 0;"), std::string::npos);
+    EXPECT_NE(out.find("rt.add(cpu.a, 0x2U, cpu.r);"), std::string::npos);
+    EXPECT_NE(out.find("cpu.r = rt.cmp(cpu.a, 0xfffffffcU);"), std::string::npos);
+    EXPECT_NE(out.find("if ((tx::int32) cpu.r != 0) goto L_400003;"), std::string::npos);
+    EXPECT_NE(out.find("if (rt.exec(4)) continue;"), std::string::npos);
+    EXPECT_NE(out.find("tx8_aot_run(cpu);"), std::string::npos);
+}
+
+// Tests if the runtime behaves like the run loop when every instruction is interpreted
+TEST_F(Aot, runtime) {
+    std::string s = R"EOF(
+ld a 3
+:loop
+sys &test_au
+dec a
+cmp a 0
+jne :loop
+stop
+)EOF";
+    auto        rom = assemble(s);
+    ASSERT_TRUE(rom.has_value());
+
+    auto cpu = make_cpu(s);
+    ASSERT_NE(cpu, nullptr);
+    tx::aot::Runtime rt(*cpu, rom.value().data(), rom.value().size(), nullptr, 0);
+    while (rt.running()) rt.step();
+
+    ASSERT_EQ(tx::log_err.get_str(), "");
+    EXPECT_EQ(cpu->p, 0x40001e);
+    EXPECT_EQ(nums, (std::vector<tx::num32_variant> {3u, 2u, 1u}));
+}
+
+// Tests if a cpu holding a different rom is left to the interpreter
+TEST_F(Aot, mismatch) {
+    auto rom   = assemble("ld a 1\nhlt\n");
+    auto other = assemble("ld a 2\nhlt\n");
+    ASSERT_TRUE(rom.has_value() && other.has_value());
+
+    tx::CPU          cpu(other.value());
+    tx::aot::Runtime rt(cpu, rom.value().data(), rom.value().size(), nullptr, 0);
+    EXPECT_FALSE(rt.running());
+    EXPECT_EQ(cpu.a, 2);
+}
+
+// Tests if translated code hands over to the interpreter once a timer is set, so a waiting loop sees the interrupt
+TEST_F(Aot, timer_interrupt) {
+    std::string s = R"EOF(
+ld #0 :handler
+zero b
+push 5000
+sys &set_timer
+pop c
+ei
+
+:loop
+cmp b 3
+jlt :loop
+
+di
+ld a b
+sys &test_au ; 3
+hlt
+
+:handler
+inc b
+ei
+ret
+)EOF";
+    auto rom = assemble(s);
+    ASSERT_TRUE(rom.has_value());
+
+    tx::aot::Translator translator(rom.value());
+    auto                code = translator.recover();
+    auto                cpu  = make_cpu(s);
+    ASSERT_NE(cpu, nullptr);
+    tx::aot::Runtime rt(*cpu, rom.value().data(), rom.value().size(), code.data(), code.size());
+    ASSERT_TRUE(rt.running());
+
+    // run the instructions before the loop like translated code, which would not leave the loop on its own
+    size_t index = 0;
+    while (!rt.exec(index)) ++index;
+    EXPECT_EQ(index, 3U);
+    EXPECT_EQ(cpu->p, code[4]);
+
+    EXPECT_FALSE(rt.running());
+    ASSERT_EQ(tx::log_err.get_str(), "");
+    EXPECT_EQ(nums, (std::vector<tx::num32_variant> {3u}));
+}
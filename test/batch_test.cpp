@@ -0,0 +1,91 @@
+#include "VMTest.hpp"
+
+#include "tx8/core/batch.hpp"
+
+#include <memory>
+
+// Tests if every job runs once with its own input and output, in parallel with the others
+TEST_F(Batch, run) {
+    // echoes its input
+    auto echo = assemble(R"EOF(
+:loop
+zero a
+sys &get
+pop ab
+ucmp a 255
+jeq :end
+push a
+sys &put
+jmp :loop
+:end
+hlt
+)EOF");
+    auto fail = assemble("div a 0\n");
+    ASSERT_TRUE(echo.has_value() && fail.has_value());
+    auto echo_rom = std::make_shared<const tx::SharedRom>(echo.value());
+    auto fail_rom = std::make_shared<const tx::SharedRom>(fail.value());
+
+    std::vector<tx::batch::Job> jobs;
+    for (int i = 0; i < 50; ++i) jobs.push_back({"echo", fmt::format("job {}", i), echo_rom});
+    jobs.push_back({"fail", "", fail_rom});
+    jobs.push_back({"missing.txr", "", nullptr});
+
+    std::vector<tx::batch::Result> results(jobs.size());
+    std::vector<int>               seen(jobs.size(), 0);
+    tx::batch::run(
+        jobs,
+        [&](const tx::batch::Result& result) {
+            results[result.job] = result;
+            ++seen[result.job];
+        },
+        4
+    );
+
+    EXPECT_EQ(seen, std::vector<int>(jobs.size(), 1));
+    for (int i = 0; i < 50; ++i) {
+        EXPECT_EQ(results[i].output, fmt::format("job {}", i));
+        EXPECT_FALSE(results[i].error);
+    }
+    EXPECT_TRUE(results[50].error);
+    EXPECT_NE(results[50].errors.find("Division by zero"), std::string::npos);
+    EXPECT_TRUE(results[51].error);
+    EXPECT_EQ(results[51].errors, "Could not load rom file missing.txr\n");
+
+    // the global loggers are left alone
+    EXPECT_EQ(tx::log.get_str(), "");
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+// Tests if workers leave an enabled global debug logger alone, as it must not be shared between threads
+TEST_F(Batch, debug_logging) {
+    auto loop = assemble("ld a 100\n:loop\ndec a\ncmp a 0\njne :loop\nhlt\n");
+    ASSERT_TRUE(loop.has_value());
+    std::vector<tx::batch::Job> jobs(20, {"loop", "", std::make_shared<const tx::SharedRom>(loop.value())});
+
+    tx::log_debug.init_str();
+    size_t finished = 0;
+    tx::batch::run(
+        jobs,
+        [&](const tx::batch::Result& result) {
+            EXPECT_FALSE(result.error);
+            ++finished;
+        },
+        4
+    );
+    std::string debug = tx::log_debug.get_str();
+    tx::log_debug.reset();
+
+    EXPECT_EQ(finished, jobs.size());
+    EXPECT_EQ(debug, "");
+}
+
+// Tests the JSON line of a result
+TEST_F(Batch, to_json) {
+    tx::batch::Job    job {"a\"b.txr", "", nullptr};
+    tx::batch::Result result {3, false, 1, 0x400010, 42, 0.5, "hi\n\t\xff", ""};
+    EXPECT_EQ(
+        tx::batch::to_json(job, result),
+        R"({"job":3,"path":"a\"b.txr","status":"halted","a":1,"p":4194320,"instructions":42,"seconds":0.500000,)"
+        R"("output":"hi\n\u0009\u00ff","errors":""})"
+    );
+}
@@ -574,3 +574,44 @@ hlt
         {(float) log10f(1.0), (float) log10f(-1.6), (float) log10f(0.0), log10f(3.14159f)}
     ); // NOLINT
 }
+
+TEST_F(Float, vector_ops) {
+    std::string s = R"EOF(
+ld #c00000 1.0
+ld #c00004 2.0
+ld #c00008 3.0
+ld #c0000c 4.0
+ld #c00010 4.0
+ld #c00014 3.0
+ld #c00018 -2.0
+ld #c0001c 8.0
+
+vdot 0xc00000 0xc00010
+sys &test_af ; 36.0
+
+vadd 0xc00000 0xc00010
+lda #c0000c
+sys &test_af ; 12.0
+
+lda 2.0
+vfma 0xc00000 0xc00010
+lda #c00008
+sys &test_af ; -3.0
+
+vmul 0xc00000 0xc00010
+lda #c00000
+sys &test_af ; 52.0
+
+vmin 0xc00000 0xc00010
+lda #c00008
+sys &test_af ; -2.0
+
+vmax 0xc00000 0xc00020
+lda #c00008
+sys &test_af ; 0.0
+lda #c00004
+sys &test_af ; 3.0
+hlt
+)EOF";
+    run_and_compare_num(s, {36.0f, 12.0f, -3.0f, 52.0f, -2.0f, 0.0f, 3.0f}); // NOLINT
+}
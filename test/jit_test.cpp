@@ -0,0 +1,238 @@
+#include "VMTest.hpp"
+
+#include "tx8/core/jit.hpp"
+
+// Tests if a compiled loop keeps its registers and flags
+TEST_F(Jit, loop) {
+    std::string s = R"EOF(
+zero a
+zero b
+:loop
+add a b
+inc b
+cmp b 1000
+jlt :loop
+sys &test_au ; 499500
+sys &test_r  ; 0
+ld a b
+sys &test_au ; 1000
+hlt
+)EOF";
+    run_and_compare_num(s, {499500u, 0u, 1000u});
+}
+
+// Tests the R register of natively compiled arithmetic
+TEST_F(Jit, flags) {
+    std::string s = R"EOF(
+ld a 0x7fffffff
+add a 1
+sys &test_r  ; 2
+ld a 0xffffffff
+uadd a 1
+sys &test_r  ; 1
+sub a 1
+sys &test_r  ; 1
+lda 0x80000000
+dec a
+sys &test_r  ; 2
+ld b 5
+ucmp a b
+sys &test_ri ; 1
+cmp a 0xff
+sys &test_ri ; 1
+lds c 255u8
+cmp c 0
+sys &test_ri ; -1
+hlt
+)EOF";
+    run_and_compare_num(s, {2u, 1u, 1u, 2u, 1, 1, -1});
+}
+
+// Tests memory loads inside compiled blocks, including the end of the memory
+TEST_F(Jit, memory) {
+    std::string s = R"EOF(
+ld #1000 0x12345678
+ld #fffffe 0xabu8
+ld b 0x1000
+ld c 0xfffffe
+ld o 0xfff000
+ld a @b
+sys &test_au ; 0x12345678
+ld a #1001
+sys &test_au ; 0x123456
+ld a #fffffe
+sys &test_au ; 0xab
+ld a @c
+sys &test_au ; 0xab
+ld a $ffe
+sys &test_au ; 0xab
+hlt
+)EOF";
+    run_and_compare_num(s, {0x12345678u, 0x123456u, 0xabu, 0xabu, 0xabu});
+}
+
+// Tests calls, stack operations and sysfuncs inside compiled blocks
+TEST_F(Jit, calls) {
+    std::string s = R"EOF(
+zero b
+:loop
+push b
+call :double
+pop a
+sys &test_au
+inc b
+cmp b 3
+jlt :loop
+hlt
+
+:double
+ld o s
+ld a $4
+add a a
+ld $4 a
+ret
+)EOF";
+    run_and_compare_num(s, {0u, 2u, 4u});
+}
+
+// Tests if writing to compiled code makes the cpu execute the new code
+TEST_F(Jit, self_modifying_code) {
+    std::string s = R"EOF(
+zero b
+:again
+lda 1 ; the constant of this instruction lives at #400005
+sys &test_au
+inc b
+cmp b 2
+jeq :end
+ld #400005 7u8
+jmp :again
+
+:end
+hlt
+)EOF";
+    run_and_compare_num(s, {1u, 7u});
+}
+
+// Tests if errors raised by instructions inside compiled blocks stop the cpu
+TEST_F(Jit, error) {
+    std::string s = R"EOF(
+lda 5
+zero b
+div a b
+lda 6
+sys &test_au
+hlt
+)EOF";
+    run_and_compare_num(
+        s,
+        {},
+        "Exception: Division by zero\nCaused by instruction:\n[#400009] div a b\n"
+    );
+}
+
+#ifdef TX8_JIT_SUPPORTED
+// Tests if hot blocks are compiled
+TEST_F(Jit, compiles_hot_blocks) {
+    std::string s = R"EOF(
+zero a
+:loop
+inc a
+cmp a 100
+jlt :loop
+hlt
+)EOF";
+    tx::Assembler as(s);
+    tx::CPU       cpu(as.generate_binary().value());
+    cpu.enable_jit(10);
+    cpu.run();
+
+    EXPECT_EQ(cpu.a, 100u);
+    ASSERT_NE(cpu.get_jit(), nullptr);
+    EXPECT_GT(cpu.get_jit()->get_compiled_count(), 0u);
+}
+
+// Tests if compiled blocks count exactly the instructions the interpreter executes, also when leaving early or looping
+TEST_F(Jit, instruction_count) {
+    std::string s = R"EOF(
+zero a
+zero b
+:loop
+inc a
+cmp a 50
+jeq :skip
+push a
+pop c
+:skip
+add b a
+cmp a 200
+jlt :loop
+hlt
+)EOF";
+    auto rom = assemble(s);
+    ASSERT_TRUE(rom.has_value());
+    tx::CPU interpreted(rom.value());
+    interpreted.run();
+    tx::CPU compiled(rom.value());
+    compiled.enable_jit(10);
+    compiled.run();
+
+    ASSERT_EQ(tx::log_err.get_str(), "");
+    EXPECT_EQ(compiled.b, interpreted.b);
+    EXPECT_GT(compiled.stats.compiled, 0u);
+    EXPECT_EQ(compiled.stats.instructions(), interpreted.stats.instructions());
+}
+
+// Tests if loads through a register address are compiled natively
+TEST_F(Jit, register_address) {
+    std::string s = R"EOF(
+ld #c00000 7
+ld b 0xc00000
+zero c
+:loop
+ld a @b
+inc c
+cmp c 100
+jlt :loop
+hlt
+)EOF";
+    tx::Assembler as(s);
+    tx::CPU       cpu(as.generate_binary().value());
+    cpu.enable_jit(10);
+    cpu.run();
+
+    EXPECT_EQ(cpu.a, 7u);
+    EXPECT_EQ(cpu.c, 100u);
+    ASSERT_NE(cpu.get_jit(), nullptr);
+    EXPECT_EQ(cpu.get_jit()->get_compiled_count(), 1u);
+    // only the hlt behind the loop calls back into the cpu
+    EXPECT_EQ(cpu.get_jit()->get_call_count(), 1u);
+}
+#endif
+
+// Tests if the timer interrupts a compiled loop
+TEST_F(Jit, timer_interrupt) {
+    std::string s = R"EOF(
+ld #0 :handler
+zero b
+push 5000
+sys &set_timer
+pop c
+ei
+
+:loop
+cmp b 3
+jlt :loop
+
+di
+ld a b
+sys &test_au ; 3
+hlt
+
+:handler
+inc b
+ei
+ret
+)EOF";
+    run_and_compare_num(s, {3u});
+}
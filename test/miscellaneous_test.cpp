@@ -1,5 +1,9 @@
 #include "VMTest.hpp"
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
 TEST_F(Miscellaneous, rand_and_rseed) {
     std::string s = R"EOF(
 rand a
@@ -164,4 +168,524 @@ hlt
     run_and_compare_num(s, {1u});
 }
 
+// Tests if writing to an already executed instruction makes the cpu execute the new instruction
+TEST_F(Miscellaneous, self_modifying_code) {
+    std::string s = R"EOF(
+zero b
+:again
+lda 1 ; the constant of this instruction lives at #400005
+sys &test_au
+inc b
+cmp b 2
+jeq :end
+ld #400005 7u8
+jmp :again
+
+:end
+hlt
+    )EOF";
+    run_and_compare_num(s, {1u, 7u});
+}
+
+// Tests if only writes to pages holding decoded instructions look for overwritten instructions
+TEST_F(Miscellaneous, code_write_counters) {
+    std::string code = R"EOF(
+zero b
+:again
+lda 1 ; the constant of this instruction lives at #400005
+ld #c00000 a
+ld #c00004 b
+inc b
+cmp b 2
+jeq :end
+ld #400005 7u8
+jmp :again
+
+:end
+hlt
+)EOF";
+    auto cpu = make_cpu(code);
+    ASSERT_NE(cpu, nullptr);
+    cpu->run();
+
+    EXPECT_EQ(cpu->a, 7U);
+    EXPECT_EQ(cpu->stats.code_writes, 1U);
+    EXPECT_EQ(cpu->stats.invalidations, 1U);
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+// Tests if stop sleeps until the timer interrupt and the handler returns behind it
+TEST_F(Miscellaneous, timer_interrupt) {
+    std::string s = R"EOF(
+ld #0 :handler
+zero b
+push 1000
+sys &set_timer
+pop c
+ei
+
+:wait
+stop
+cmp b 3
+jlt :wait
+
+push 0
+sys &set_timer
+pop c
+ld a b
+sys &test_au
+hlt
+
+:handler
+inc b
+ei
+ret
+)EOF";
+    run_and_compare_num(s, {3u});
+}
+
+// Tests if interrupts raised while disabled stay pending and still end a stop
+TEST_F(Miscellaneous, pending_interrupts) {
+    std::string code = R"EOF(
+ld #4 :handler
+stop
+lda 1
+ei
+jmp :next
+:next
+lda 2
+hlt
+
+:handler
+ld b a
+ei
+ret
+)EOF";
+    auto cpu = make_cpu(code);
+    ASSERT_NE(cpu, nullptr);
+    cpu->schedule_interrupt(tx::INTERRUPT_VBLANK, 500);
+    cpu->run();
+
+    // the handler is called at the first jump after ei
+    EXPECT_EQ(cpu->b, 1U);
+    EXPECT_EQ(cpu->a, 2U);
+    EXPECT_EQ(cpu->stats.interrupts, 1U);
+    EXPECT_GE(cpu->stats.cycles(), 500U);
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+// Tests if loops polling memory set by an interrupt handler are skipped up to the interrupt
+TEST_F(Miscellaneous, idle_loops) {
+    std::string code = R"EOF(
+ld #4 :vblank
+zero b
+ei
+
+:wait
+cmp #c00000 0
+jeq :wait
+ld #c00000 0
+inc b
+cmp b 3
+jlt :wait
+
+; counting is not idle
+:count
+inc c
+cmp #c00000 0
+jeq :count
+hlt
+
+:vblank
+ld #c00000 1
+ei
+ret
+)EOF";
+    auto cpu = make_cpu(code);
+    ASSERT_NE(cpu, nullptr);
+    cpu->schedule_interrupt(tx::INTERRUPT_VBLANK, 100000, 100000);
+    cpu->run();
+
+    EXPECT_EQ(cpu->b, 3U);
+    EXPECT_EQ(cpu->stats.interrupts, 4U);
+    EXPECT_EQ(cpu->stats.idle_loops, 3U);
+    EXPECT_GE(cpu->stats.cycles(), 400000U);
+    EXPECT_LT(cpu->stats.instructions(), 200000U);
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+// Tests if writing to the jump of a fused compare and jump makes the cpu execute the new jump
+TEST_F(Miscellaneous, self_modifying_fused_jump) {
+    std::string s = R"EOF(
+zero b
+:again
+cmp a a
+jeq :one ; the target of this jump lives at #400009
+hlt
+
+:one
+inc b
+ld a b
+sys &test_au
+cmp b 2
+jge :end
+ld #400009 :two
+jmp :again
+
+:two
+lda 3
+sys &test_au
+
+:end
+hlt
+    )EOF";
+    run_and_compare_num(s, {1u, 3u});
+}
+
+// Tests if the pending overflow flags of additions and subtractions are computed wherever R is read
+TEST_F(Miscellaneous, lazy_r) {
+    std::string s = R"EOF(
+ld a 0x7fffffff
+add a 1
+ld a r
+sys &test_au ; 2
+ld b 0xff
+inc bb
+jne :taken
+hlt
+:taken
+push r
+pop a
+sys &test_au ; 1
+usub a 2
+ld rb 0x10u8
+ld a r
+sys &test_au ; 0x10
+dec a
+ld rs 0u16
+sys &test_r  ; 0
+hlt
+    )EOF";
+    run_and_compare_num(s, {2u, 1u, 0x10u, 0u});
+}
+
+// Tests if the lazily allocated memory reads as zero outside the rom and keeps writes at its far end
+TEST_F(Miscellaneous, memory_zeroed) {
+    std::string s = R"EOF(
+ld a #800000
+sys &test_au ; 0
+ld #fffffb 0x12345678
+ld a #fffffb
+sys &test_au ; 0x12345678
+hlt
+    )EOF";
+    run_and_compare_num(s, {0u, 0x12345678u});
+}
+
+// Tests if a mapped rom file runs like a copied rom, reads as zero around the rom and is never written to
+TEST_F(Miscellaneous, rom_file) {
+    std::string s = R"EOF(
+ld a #3ffffc
+sys &test_au ; 0
+ld a #400100
+sys &test_au ; 0
+ld #400000 0xffffffff
+ld a #400000
+sys &test_au ; 0xffffffff
+hlt
+    )EOF";
+    auto rom = assemble(s);
+    ASSERT_TRUE(rom.has_value());
+
+    // an odd header size, so the rom is not page aligned in the file
+    auto header = tx::build_header({(tx::uint32) rom.value().size(), "rom", "file"});
+    header.insert(header.end(), rom.value().begin(), rom.value().end());
+    std::string path = testing::TempDir() + "tx8_rom_file.txr";
+    std::ofstream(path, std::ios::out | std::ios::binary).write((char*) header.data(), (long) header.size());
+
+    auto file = tx::open_rom_file(path);
+    ASSERT_TRUE(file.has_value());
+    EXPECT_EQ(file.value().offset, header.size() - rom.value().size());
+    {
+        tx::CPU cpu(file.value());
+        use_testing_stdlib(cpu);
+        cpu.run();
+    }
+
+    std::ifstream          in(path, std::ios::in | std::ios::binary);
+    std::vector<tx::uint8> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::remove(path.c_str());
+
+    ASSERT_EQ(tx::log_err.get_str(), "");
+    EXPECT_EQ(nums, (std::vector<tx::num32_variant> {0u, 0u, 0xffffffffu}));
+    EXPECT_EQ(contents, header);
+}
+
+// Tests if cpus sharing a rom each see their own writes to it
+TEST_F(Miscellaneous, shared_rom) {
+    auto rom = assemble("ld #400000 0x12345678\nhlt\n");
+    ASSERT_TRUE(rom.has_value());
+
+    tx::SharedRom shared(rom.value());
+    tx::CPU       first(shared);
+    tx::CPU       second(shared);
+    first.run();
+
+    ASSERT_EQ(tx::log_err.get_str(), "");
+    EXPECT_EQ(first.mem_read(0x400000), 0x12345678);
+    EXPECT_TRUE(std::equal(rom.value().begin(), rom.value().end(), second.mem.begin() + tx::ROM_START));
+    EXPECT_TRUE(std::equal(rom.value().begin(), rom.value().end(), shared.data().begin()));
+
+    second.run();
+    EXPECT_EQ(second.mem_read(0x400000), 0x12345678);
+}
+
+// Tests if restoring a snapshot undoes memory writes (including to code), registers and the random seed
+TEST_F(Miscellaneous, snapshot_restore) {
+    std::string s = R"EOF(
+ld a #800000
+inc a
+ld #800000 a
+sys &test_au
+ld #400000 0u8 ; overwrite the first instruction with hlt
+rand a
+sys &test_r
+hlt
+    )EOF";
+    auto cpu = make_cpu(s);
+    ASSERT_NE(cpu, nullptr);
+    auto snap = cpu->snapshot();
+    for (int i = 0; i < 3; ++i) {
+        cpu->run();
+        cpu->restore(snap);
+    }
+
+    ASSERT_EQ(tx::log_err.get_str(), "");
+    EXPECT_EQ(nums, (std::vector<tx::num32_variant> {1u, 0x33e9u, 1u, 0x33e9u, 1u, 0x33e9u}));
+    EXPECT_EQ(cpu->p, tx::ENTRY_POINT);
+    EXPECT_EQ(cpu->mem_read(0x800000), 0);
+
+    cpu->snapshot();
+    cpu->restore(snap);
+    EXPECT_EQ(tx::log_err.get_str(), "Cannot restore snapshot 1, only the latest snapshot of a cpu can be restored\n");
+    tx::log_err.reset();
+}
+
+// Tests if cpus with their own sinks do not write to the global loggers
+TEST_F(Miscellaneous, sinks) {
+    tx::Log out;
+    tx::Log err;
+    out.init_str();
+    err.init_str();
+    auto cpu = make_cpu("push 65u8\nsys &put\ndiv a 0\n", {&out, &err, &tx::log_debug});
+    ASSERT_NE(cpu, nullptr);
+    cpu->run();
+
+    EXPECT_EQ(out.get_str(), "A");
+    EXPECT_NE(err.get_str().find("Division by zero"), std::string::npos);
+    EXPECT_EQ(tx::log.get_str(), "");
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+// Tests the memory and string sysfuncs of the standard library, also at the end of the memory
+TEST_F(Miscellaneous, stdlib_memory) {
+    std::string s = R"EOF(
+push 6
+push "hello"
+push 0xc00000
+sys &memcpy
+push 3
+push 120
+push 0xc00001
+sys &memset
+push 0xc00000
+sys &println
+sys &strlen
+sys &print_u32
+
+push "abd"
+push "abc"
+sys &strcmp
+sys &print_i32
+push 3
+push "abc"
+push "abc"
+sys &memcmp
+sys &print_i32
+
+; the byte at the end of the memory is out of bounds, writes behind it wrap around
+push 4
+push 120
+push 0xfffffe
+sys &memset
+push 0xfffffe
+sys &strlen
+sys &print_u32
+push 0
+sys &strlen
+sys &print_u32
+hlt
+)EOF";
+    run_and_compare_str(s, "hxxxo\n5-1012");
+}
+
+// Tests if mcpy and mset handle overlapping ranges and the end of the memory
+TEST_F(Miscellaneous, bulk_memory_ops) {
+    std::string s = R"EOF(
+ld a "hello"
+mcpy 0xc00000 6
+ld b 120
+ld c 0xc00001
+mset c 3
+push 0xc00000
+sys &println
+
+; overlapping copy to the right
+ld a 0xc00000
+mcpy 0xc00001 5
+sys &println
+
+; wrapping around the end of the memory, the byte at 0xffffff is skipped
+ld a "abc"
+mcpy 0xfffffe 4
+ld a 0xfffffe
+mcpy 0xc00000 4
+sys &println
+hlt
+)EOF";
+    run_and_compare_str(s, "hxxxo\nhhxxxo\na\n");
+}
+
+// Tests if accesses at the end of the memory are cut off and addresses wrap around
+TEST_F(Miscellaneous, memory_edge) {
+    auto cpu = make_cpu("hlt\n");
+    ASSERT_NE(cpu, nullptr);
+
+    // bytes past the end of the memory are ignored on writes and read as zero
+    cpu->mem_write(0xfffffc, 0x44332211);
+    cpu->mem_write(0xfffffe, 0xaabbccdd);
+    EXPECT_EQ(cpu->mem_read(0xfffffc), 0x00dd2211U);
+    EXPECT_EQ(cpu->mem_read(0xffffff), 0U);
+    EXPECT_EQ(cpu->mem_read<tx::ValueSize::Short>(0xfffffe), 0x00ddU);
+    cpu->mem_write<tx::ValueSize::Byte>(0xffffff, 0x12);
+    EXPECT_EQ(cpu->mem_read<tx::ValueSize::Byte>(0xffffff), 0U);
+
+    // addresses wrap around at 24 bits
+    cpu->mem_write<tx::ValueSize::Short>(0x1c00000, 0xbeef);
+    EXPECT_EQ(cpu->mem_read(0xc00000), 0xbeefU);
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+/// Device logging every access and reading back its offsets
+struct LoggingDevice : tx::Device {
+    std::vector<std::string> accesses;
+
+    tx::uint32 read(tx::mem_addr offset, tx::ValueSize size) override {
+        accesses.push_back(fmt::format("r {:x} {}", offset, (tx::uint32) size));
+        return 0x04030201U * (offset + 1);
+    }
+    void write(tx::mem_addr offset, tx::uint32 value, tx::ValueSize size) override {
+        accesses.push_back(fmt::format("w {:x} {} {:x}", offset, (tx::uint32) size, value));
+    }
+};
+
+// Tests if accesses to mapped devices reach the device, also when they only partially overlap it
+TEST_F(Miscellaneous, memory_bus_devices) {
+    std::string code = R"EOF(
+ld #1004 0x11223344
+lda #1008
+ld #ffe 0xaabbccdd
+ld b #ffe
+hlt
+)EOF";
+    auto cpu = make_cpu(code);
+    ASSERT_NE(cpu, nullptr);
+    LoggingDevice device;
+    cpu->map_device(0x1000, 0x2000, device);
+    cpu->run();
+    EXPECT_EQ(tx::log_err.get_str(), "");
+
+    // accesses crossing into the device are split into bytes, the memory part is still written
+    std::vector<std::string> expected = {
+        "w 4 4 11223344", "r 8 4", "w 0 1 bb", "w 1 1 aa", "r 0 1", "r 1 1",
+    };
+    EXPECT_EQ(device.accesses, expected);
+    EXPECT_EQ(cpu->a, 0x241b1209U);
+    EXPECT_EQ(cpu->b, 0x0201ccddU);
+
+    // memory behind unmapped devices is plain memory again
+    cpu->unmap_device(device);
+    cpu->mem_write(0x1004, 0x55);
+    EXPECT_EQ(cpu->mem_read(0x1004), 0x55U);
+    EXPECT_EQ(device.accesses.size(), expected.size());
+
+    cpu->map_device(0x1800, 0x1000, device);
+    EXPECT_NE(tx::log_err.get_str(), "");
+}
+
+// Tests if replacing a sysfunc also replaces it in already decoded instructions
+TEST_F(Miscellaneous, sysfunc_table) {
+    auto cpu = make_cpu("sys &count\nsys &count\nhlt\n");
+    ASSERT_NE(cpu, nullptr);
+    int calls = 0;
+    cpu->register_sysfunc("count", [&](tx::CPU&) { ++calls; });
+    tx::Snapshot snap = cpu->snapshot();
+    cpu->run();
+    EXPECT_EQ(calls, 2);
+
+    // the decoded instructions call the replacement
+    cpu->replace_sysfunc("count", [&](tx::CPU&) { calls += 10; });
+    cpu->restore(snap);
+    cpu->run();
+    EXPECT_EQ(calls, 22);
+    EXPECT_EQ(tx::log_err.get_str(), "");
+}
+
+// Tests if buffered loggers write to streams only when flushed
+TEST_F(Miscellaneous, buffered_sinks) {
+    std::ostringstream stream;
+    tx::Log            out;
+    out.init_stream(&stream);
+    out.init_str();
+    out("{}", 1);
+    // strings receive messages immediately, streams when the buffer is flushed
+    EXPECT_EQ(out.get_str(), "1");
+    EXPECT_EQ(stream.str(), "");
+    out.flush();
+    EXPECT_EQ(stream.str(), "1");
+
+    auto cpu = make_cpu("push 65u8\nsys &put\nsys &put\nhlt\n", {&out, &tx::log_err, &tx::log_debug});
+    ASSERT_NE(cpu, nullptr);
+    cpu->run();
+    EXPECT_EQ(stream.str(), "1AA");
+
+    out.set_flush_threshold(0);
+    out("{}", 2);
+    EXPECT_EQ(stream.str(), "1AA2");
+}
+
+// Tests if asynchronous loggers write everything in order, or drop messages not fitting into the ring
+TEST_F(Miscellaneous, async_sinks) {
+    std::ostringstream stream;
+    std::string        expected;
+    tx::Log            out;
+    out.init_stream(&stream);
+    // a small ring, so the logger has to wait for the writer thread
+    out.init_async(64);
+    for (int i = 0; i < 10000; ++i) {
+        out("{} ", i);
+        expected += fmt::format("{} ", i);
+    }
+    out.sync();
+    EXPECT_EQ(stream.str(), expected);
+
+    out.init_async(16, tx::LogOverflow::Drop);
+    out.set_flush_threshold(0);
+    out("{}", "does not fit into the ring");
+    out("{}", "fits");
+    out.sync();
+    EXPECT_EQ(out.dropped(), 26);
+    EXPECT_EQ(stream.str(), expected + "fits");
+}
+
 #pragma clang diagnostic pop